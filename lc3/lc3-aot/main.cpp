@@ -0,0 +1,33 @@
+
+#include "translator.h"
+
+#include <fstream>
+#include <iostream>
+
+int main(int argc, const char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: lc3-aot <image.obj> <output.cpp> [symbol]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream obj_s(argv[1], std::ios::binary);
+    object_image image;
+    if (!obj_s || !read_object(obj_s, image))
+    {
+        std::cerr << "failed to read " << argv[1] << std::endl;
+        return 1;
+    }
+
+    translator tr(image);
+    std::ofstream out(argv[2]);
+    if (!out)
+    {
+        std::cerr << "failed to open " << argv[2] << std::endl;
+        return 1;
+    }
+    tr.write(out, argv[1], argc > 3 ? argv[3] : "lc3_image");
+    std::cout << "translated " << tr.block_count() << " blocks" << std::endl;
+    return 0;
+}
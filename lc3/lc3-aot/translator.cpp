@@ -0,0 +1,313 @@
+#include "translator.h"
+
+#include "../lc3-vm/op_codes.h"
+
+#include <sstream>
+#include <stdio.h>
+
+namespace
+{
+    const uint16_t tr_halt = 0x25;
+
+    std::string hex(uint32_t value)
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "0x%04X", value);
+        return buf;
+    }
+
+    std::string reg(uint8_t r)
+    {
+        return "r[" + std::to_string(r) + "]";
+    }
+
+    std::string condition(uint8_t mask)
+    {
+        std::string c;
+        if (mask & 0x4)
+            c += "s.n()";
+        if (mask & 0x2)
+            c += std::string(c.empty() ? "" : " || ") + "s.z()";
+        if (mask & 0x1)
+            c += std::string(c.empty() ? "" : " || ") + "s.p()";
+        return c;
+    }
+}
+
+translator::translator(const object_image &image)
+    : image_(image), code_(image.words.size(), 0)
+{
+    discover();
+}
+
+size_t translator::block_count() const
+{
+    return leaders_.size();
+}
+
+bool translator::in_image(uint16_t address) const
+{
+    return static_cast<uint16_t>(address - image_.origin) < image_.words.size();
+}
+
+void translator::discover()
+{
+    std::vector<uint16_t> work;
+    if (!image_.words.empty())
+    {
+        work.push_back(image_.origin);
+        leaders_.insert(image_.origin);
+    }
+
+    auto branch = [&](uint16_t target)
+    {
+        if (in_image(target))
+        {
+            leaders_.insert(target);
+            work.push_back(target);
+        }
+    };
+
+    while (!work.empty())
+    {
+        uint16_t pc = work.back();
+        work.pop_back();
+        while (in_image(pc) && !code_[pc - image_.origin])
+        {
+            code_[pc - image_.origin] = 1;
+            auto inst = decode(image_.words[pc - image_.origin]);
+            uint16_t next = pc + 1;
+            uint16_t target = next + inst.imm;
+            bool open = true;
+            switch (inst.op)
+            {
+            case op_codes::op_br:
+                if (inst.dr != 0)
+                {
+                    branch(target);
+                    if (inst.dr == 0x7)
+                        open = false;
+                    else
+                        leaders_.insert(next);
+                }
+                break;
+            case op_codes::op_jsr:
+                if (inst.mode)
+                    branch(target);
+                leaders_.insert(next);
+                break;
+            case op_codes::op_trap:
+                leaders_.insert(next);
+                open = inst.imm != tr_halt;
+                break;
+            case op_codes::op_jmp:
+            case op_codes::op_rti:
+            case op_codes::op_res:
+                open = false;
+                break;
+            default:
+                break;
+            }
+            if (!open)
+                break;
+            pc = next;
+        }
+    }
+
+    // only keep leaders that turned out to be code
+    for (auto it = leaders_.begin(); it != leaders_.end();)
+    {
+        if (in_image(*it) && code_[*it - image_.origin])
+            ++it;
+        else
+            it = leaders_.erase(it);
+    }
+}
+
+void translator::write(std::ostream &out, const std::string &source, const std::string &name)
+{
+    auto size = image_.words.size();
+
+    out << "// Translated by lc3-aot from " << source << ", do not edit.\n";
+    out << "#include \"aot.h\"\n\n";
+    out << "namespace\n{\n";
+
+    out << "    const uint16_t words[] =\n    {";
+    for (size_t i = 0; i < size; ++i)
+    {
+        out << (i % 8 ? " " : "\n        ") << hex(image_.words[i]) << ",";
+    }
+    out << "\n    };\n\n";
+
+    out << "    const uint8_t code[] =\n    {";
+    for (size_t i = 0; i < size; ++i)
+    {
+        out << (i % 32 ? " " : "\n        ") << static_cast<int>(code_[i]) << ",";
+    }
+    out << "\n    };\n";
+
+    for (auto leader : leaders_)
+    {
+        out << "\n";
+        write_block(out, leader);
+    }
+
+    out << "\n    const aot_block blocks[] =\n    {";
+    for (size_t i = 0; i < size; ++i)
+    {
+        uint16_t pc = static_cast<uint16_t>(image_.origin + i);
+        out << (i % 8 ? " " : "\n        ");
+        if (leaders_.count(pc))
+            out << "b_" << hex(pc).substr(2) << ",";
+        else
+            out << "nullptr,";
+    }
+    out << "\n    };\n";
+    out << "}\n\n";
+
+    out << "extern const aot_image " << name << " = { " << hex(image_.origin) << ", " << size
+        << ", words, blocks, code };\n";
+}
+
+void translator::write_block(std::ostream &out, uint16_t start)
+{
+    // find the end of the block first, the budget check needs its length
+    std::vector<decoded> insts;
+    uint16_t pc = start;
+    bool open = true;
+    while (open)
+    {
+        if (pc != start && (leaders_.count(pc) || !in_image(pc) || !code_[pc - image_.origin]))
+            break;
+        auto inst = decode(image_.words[pc - image_.origin]);
+        insts.push_back(inst);
+        open = !ends_block(inst);
+        ++pc;
+    }
+    bool interpreted = !insts.empty() && runs_in_interpreter(insts.back());
+    int length = static_cast<int>(insts.size()) - (interpreted ? 1 : 0);
+
+    std::ostringstream body;
+    for (int i = 0; i < static_cast<int>(insts.size()); ++i)
+    {
+        write_instruction(body, start + i, insts[i], length - i - 1);
+    }
+    if (open)
+    {
+        body << "        return " << hex(pc) << ";\n";
+    }
+
+    auto text = body.str();
+    out << "    uint32_t b_" << hex(start).substr(2) << "(aot_state &s)\n    {\n";
+    if (length > 0)
+    {
+        out << "        if (s.budget < " << length << ")\n"
+            << "            return " << hex(start) << " | aot_state::interpret;\n"
+            << "        s.budget -= " << length << ";\n";
+    }
+    if (text.find("r[") != std::string::npos)
+        out << "        uint16_t *r = s.regs;\n";
+    out << text;
+    out << "    }\n";
+}
+
+bool translator::ends_block(const decoded &inst)
+{
+    switch (inst.op)
+    {
+    case op_codes::op_br:
+        return inst.dr != 0;
+    case op_codes::op_jmp:
+    case op_codes::op_jsr:
+    case op_codes::op_trap:
+    case op_codes::op_rti:
+    case op_codes::op_res:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool translator::runs_in_interpreter(const decoded &inst)
+{
+    return inst.op == op_codes::op_trap || inst.op == op_codes::op_rti || inst.op == op_codes::op_res;
+}
+
+void translator::write_instruction(std::ostream &out, uint16_t pc, const decoded &inst, int remaining)
+{
+    uint16_t next = pc + 1;
+    uint16_t target = next + inst.imm;
+    auto d = reg(inst.dr);
+    auto s1 = reg(inst.sr1);
+    auto s2 = reg(inst.sr2);
+    auto cc = "        s.cc = " + d + ";\n";
+
+    switch (inst.op)
+    {
+    case op_codes::op_add:
+        out << "        " << d << " = uint16_t(" << s1 << " + " << (inst.mode ? hex(inst.imm) : s2) << ");\n" << cc;
+        return;
+    case op_codes::op_and:
+        out << "        " << d << " = " << s1 << " & " << (inst.mode ? hex(inst.imm) : s2) << ";\n" << cc;
+        return;
+    case op_codes::op_not:
+        out << "        " << d << " = uint16_t(~" << s1 << ");\n" << cc;
+        return;
+    case op_codes::op_lea:
+        out << "        " << d << " = " << hex(target) << ";\n" << cc;
+        return;
+    case op_codes::op_ld:
+        out << "        " << d << " = s.read(" << hex(target) << ");\n" << cc;
+        return;
+    case op_codes::op_ldi:
+        out << "        " << d << " = s.read(s.read(" << hex(target) << "));\n" << cc;
+        return;
+    case op_codes::op_ldr:
+        out << "        " << d << " = s.read(uint16_t(" << s1 << " + " << hex(inst.imm) << "));\n" << cc;
+        return;
+    case op_codes::op_st:
+        out << "        if (s.write(" << hex(target) << ", " << d << "))\n"
+            << "            return s.refund(" << remaining << ", " << hex(next) << ");\n";
+        return;
+    case op_codes::op_sti:
+        out << "        if (s.write(s.read(" << hex(target) << "), " << d << "))\n"
+            << "            return s.refund(" << remaining << ", " << hex(next) << ");\n";
+        return;
+    case op_codes::op_str:
+        out << "        if (s.write(uint16_t(" << s1 << " + " << hex(inst.imm) << "), " << d << "))\n"
+            << "            return s.refund(" << remaining << ", " << hex(next) << ");\n";
+        return;
+    case op_codes::op_br:
+        if (inst.dr == 0)
+            return;
+        if (inst.dr == 0x7)
+        {
+            out << "        return " << hex(target) << ";\n";
+            return;
+        }
+        out << "        if (" << condition(inst.dr) << ")\n"
+            << "            return " << hex(target) << ";\n"
+            << "        return " << hex(next) << ";\n";
+        return;
+    case op_codes::op_jmp:
+        out << "        return " << s1 << ";\n";
+        return;
+    case op_codes::op_jsr:
+        if (inst.mode)
+        {
+            out << "        r[7] = " << hex(next) << ";\n"
+                << "        return " << hex(target) << ";\n";
+        }
+        else
+        {
+            out << "        uint16_t target = " << s1 << ";\n"
+                << "        r[7] = " << hex(next) << ";\n"
+                << "        return target;\n";
+        }
+        return;
+    default:
+        // trap, rti and the reserved opcode run in the interpreter
+        out << "        return " << hex(pc) << " | aot_state::interpret;\n";
+        return;
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef __translator_h__
+#define __translator_h__
+
+#include "../lc3-vm/decode_cache.h"
+#include "../lc3-vm/object.h"
+
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Walks an object image from its origin and writes C++ for every reachable
+// basic block, see lc3-vm/aot.h for the runtime side.
+class translator
+{
+public:
+    explicit translator(const object_image &image);
+
+    void write(std::ostream &out, const std::string &source, const std::string &name);
+    size_t block_count() const;
+
+private:
+    void discover();
+    bool in_image(uint16_t address) const;
+    void write_block(std::ostream &out, uint16_t start);
+    void write_instruction(std::ostream &out, uint16_t pc, const decoded &inst, int remaining);
+    static bool ends_block(const decoded &inst);
+    static bool runs_in_interpreter(const decoded &inst);
+
+private:
+    const object_image &image_;
+    std::vector<uint8_t> code_;
+    std::set<uint16_t> leaders_;
+};
+
+#endif // __translator_h__
@@ -0,0 +1,106 @@
+#include "../lc3-vm/assembler.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string &what)
+    {
+        if (!ok)
+        {
+            printf("FAIL %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    std::string errors(const assembly &program)
+    {
+        std::string all;
+        for (auto &e : program.errors)
+        {
+            all += "\n    line " + std::to_string(e.line) + ": " + e.message;
+        }
+        return all;
+    }
+
+    // the words of the first segment from address on
+    bool words_at(const assembly &program, uint16_t address, const std::vector<uint16_t> &expected)
+    {
+        if (program.segments.empty())
+            return false;
+        auto &s = program.segments[0];
+        size_t at = static_cast<uint16_t>(address - s.origin);
+        return at + expected.size() <= s.words.size() &&
+            std::equal(expected.begin(), expected.end(), s.words.begin() + at);
+    }
+
+    void blkw()
+    {
+        assembly program;
+        bool ok = assemble(
+            "        .ORIG x3000\n"
+            "        .BLKW 2\n"
+            "        .BLKW 3 x41\n"
+            "        .BLKW 2 #-1\n"
+            "        .BLKW 1 HERE\n"
+            "HERE    .FILL #7\n"
+            "        .END\n", program);
+        check(ok, ".BLKW with a fill assembles" + errors(program));
+        check(words_at(program, 0x3000, { 0, 0, 0x41, 0x41, 0x41, 0xFFFF, 0xFFFF, 0x3008, 7 }),
+            ".BLKW fills with a number or a label");
+
+        assembly bad;
+        check(!assemble(".ORIG x3000\n.BLKW 2 NOWHERE\n.END\n", bad), ".BLKW with an undefined fill fails");
+        assembly extra;
+        check(!assemble(".ORIG x3000\n.BLKW 2 #0 #1\n.END\n", extra), ".BLKW with two fills fails");
+    }
+
+    void unknown_opcode()
+    {
+        assembly labeled;
+        assemble(".ORIG x3000\nLOOP FOO R1\n.END\n", labeled);
+        check(labeled.errors.size() == 1 && labeled.errors[0].message == "unknown opcode FOO",
+            "LOOP FOO R1 names FOO" + errors(labeled));
+
+        assembly bare;
+        assemble(".ORIG x3000\nFOO R1\n.END\n", bare);
+        check(bare.errors.size() == 1 && bare.errors[0].message == "unknown opcode FOO",
+            "FOO R1 names FOO" + errors(bare));
+    }
+
+    // the sample that comes with the extension interface, whose stack is a
+    // .BLKW with a fill
+    void extension_test(const std::string &path)
+    {
+        std::ifstream in(path);
+        std::stringstream text;
+        text << in.rdbuf();
+        check(!!in, "cannot read " + path);
+        if (!in)
+            return;
+
+        assembly program;
+        check(assemble(text.str(), program), path + " assembles" + errors(program));
+        uint16_t ascii = 0, stack = 0;
+        check(program.symbols.find("ASCII", ascii) && program.symbols.find("Stack", stack) && stack - ascii == 101,
+            "the stack of " + path + " is 100 words");
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    // lc3-asm-test [ExtensionTest.asm], run from its project directory the
+    // sample is found on its own
+    blkw();
+    unknown_opcode();
+    extension_test(argc > 1 ? argv[1] : "../tools/ExtensionSample/ExtensionTest.asm");
+    printf(failures ? "%d failed\n" : "all passed\n", failures);
+    return failures ? 1 : 0;
+}
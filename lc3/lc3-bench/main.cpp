@@ -0,0 +1,424 @@
+
+#include "programs.h"
+#include "../lc3-vm/config.h"
+#include "../lc3-vm/disasm.h"
+#include "../lc3-vm/farm.h"
+#include "../lc3-vm/vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock bench_clock;
+
+    // a run that needs more than this is taken to be stuck
+    const uint64_t run_limit = 1ull << 32;
+
+    struct options
+    {
+        std::vector<std::string> engines;
+        std::vector<size_t> farms;  // threads of each farm run
+        double min_time = 0.5;  // seconds per trial
+        int trials = 3;
+        const char *json = nullptr;
+    };
+
+    struct timing
+    {
+        std::string engine;
+        bool ok = false;
+        uint64_t runs = 0;
+        double seconds = 0;     // for all runs of the best trial
+    };
+
+    struct result
+    {
+        std::string name;
+        uint64_t instructions = 0;  // per run
+        std::array<uint64_t, 16> mix = { 0 };
+        std::vector<timing> timings;
+        std::string error;
+    };
+
+    double since(bench_clock::time_point start)
+    {
+        return std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+
+    double mips(const result &r, const timing &t)
+    {
+        return t.seconds > 0 ? r.instructions * t.runs / t.seconds / 1e6 : 0;
+    }
+
+    double ns_per_instruction(const result &r, const timing &t)
+    {
+        return r.instructions ? t.seconds * 1e9 / (r.instructions * t.runs) : 0;
+    }
+
+    // Runs machine to the end with a profiler attached and keeps the opcode
+    // mix in r.
+    exit_reason count_mix(vm &machine, result &r)
+    {
+        profiler prof;
+        machine.set_profiler(&prof);
+        auto reason = machine.run_for(run_limit);
+        machine.set_profiler(nullptr);
+        for (size_t op = 0; op < r.mix.size(); ++op)
+        {
+            r.mix[op] = prof.count(static_cast<op_codes>(op));
+        }
+        return reason;
+    }
+
+    // Times one program on one engine. Every run starts from the snapshot
+    // taken after loading, so runs only differ by the pages they dirtied.
+    // The first run checks the output and warms the decode cache and the jit,
+    // then each trial repeats the program for at least min_time and the
+    // fastest trial is kept.
+    bool measure(const benchmark &b, const std::string &engine, const options &opt, result &r)
+    {
+        auto out = new capture_sink();
+        auto keys = new replayed_input(b.keys);
+        vm machine(std::unique_ptr<input_source>(keys),
+            std::unique_ptr<output_buffer>(new output_buffer(std::unique_ptr<output_sink>(out))));
+        machine.use_jit(engine == "jit");
+        if (engine == "plain")
+            machine.set_fusions(fusion_set());
+        machine.load(b.image);
+        machine.set_entry(b.image.origin);
+        machine.reset();
+        auto start = machine.snapshot();
+
+        if (machine.run_for(run_limit) != exit_reason::halted)
+        {
+            r.error = b.keys.empty() ? "does not halt without input" : "does not halt on its recorded input";
+            return false;
+        }
+        if (r.instructions != 0 && r.instructions != machine.executed())
+        {
+            r.error = engine + " executed a different number of instructions";
+            return false;
+        }
+        r.instructions = machine.executed();
+
+        timing t;
+        t.engine = engine;
+        t.ok = b.expected.empty() || out->str() == b.expected;
+        for (int trial = 0; trial < opt.trials; ++trial)
+        {
+            uint64_t runs = 0;
+            double elapsed;
+            auto begin = bench_clock::now();
+            do
+            {
+                out->clear();
+                keys->rewind();
+                machine.restore(start);
+                machine.run_for(run_limit);
+                ++runs;
+            } while ((elapsed = since(begin)) < opt.min_time);
+
+            if (t.runs == 0 || elapsed / runs < t.seconds / t.runs)
+            {
+                t.runs = runs;
+                t.seconds = elapsed;
+            }
+        }
+
+        // the opcode mix is the same for every engine, count it once
+        if (r.timings.empty())
+        {
+            keys->rewind();
+            machine.restore(start);
+            count_mix(machine, r);
+        }
+        r.timings.push_back(t);
+        return true;
+    }
+
+    // Times many copies of a program running at once on a farm with the
+    // given number of threads, to see how throughput scales with cores. Each
+    // round loads a fresh batch of vms, so loading counts as part of a run.
+    // The recorded keys are all there from the start rather than arriving at
+    // their instruction counts.
+    bool measure_farm(const benchmark &b, size_t threads, const options &opt, result &r)
+    {
+        std::string keys;
+        for (auto &e : b.keys)
+        {
+            keys += static_cast<char>(e.key);
+        }
+        // a farm vm has no budget, run the program on its own first to make
+        // sure it halts
+        if (r.instructions == 0)
+        {
+            vm machine(std::unique_ptr<input_source>(new replayed_input(b.keys)),
+                std::unique_ptr<output_buffer>(new output_buffer(std::unique_ptr<output_sink>(new capture_sink()))));
+            machine.load(b.image);
+            machine.set_entry(b.image.origin);
+            machine.reset();
+            if (count_mix(machine, r) != exit_reason::halted)
+            {
+                r.error = b.keys.empty() ? "does not halt without input" : "does not halt on its recorded input";
+                return false;
+            }
+            r.instructions = machine.executed();
+        }
+
+        const size_t batch = threads * 16;
+        timing t;
+        t.engine = "farm" + std::to_string(threads);
+        t.ok = true;
+        for (int trial = 0; trial < opt.trials; ++trial)
+        {
+            uint64_t runs = 0;
+            double elapsed;
+            auto begin = bench_clock::now();
+            do
+            {
+                farm vms(threads);
+                for (size_t i = 0; i < batch; ++i)
+                {
+                    auto id = vms.add(b.image);
+                    if (!keys.empty())
+                        vms.feed(id, keys);
+                    vms.close_input(id);
+                }
+                vms.wait();
+                for (size_t id = 0; id < batch; ++id)
+                {
+                    if (vms.reason(id) != exit_reason::halted || vms.executed(id) != r.instructions)
+                    {
+                        r.error = t.engine + " executed a different number of instructions";
+                        return false;
+                    }
+                    t.ok &= b.expected.empty() || vms.output(id) == b.expected;
+                }
+                runs += batch;
+            } while ((elapsed = since(begin)) < opt.min_time);
+
+            if (t.runs == 0 || elapsed / runs < t.seconds / t.runs)
+            {
+                t.runs = runs;
+                t.seconds = elapsed;
+            }
+        }
+        r.timings.push_back(t);
+        return true;
+    }
+
+    std::string quoted(const std::string &s)
+    {
+        std::string q = "\"";
+        for (auto c : s)
+        {
+            if (c == '"' || c == '\\')
+                q += '\\';
+            q += c;
+        }
+        return q + "\"";
+    }
+
+    void report(FILE *out, const std::vector<result> &results)
+    {
+        fprintf(out, "%-12s %-7s %12s %8s %9s %9s  %s\n", "program", "engine", "instructions", "runs", "MIPS", "ns/inst", "output");
+        for (auto &r : results)
+        {
+            if (!r.error.empty())
+            {
+                fprintf(out, "%-12s %s\n", r.name.c_str(), r.error.c_str());
+                continue;
+            }
+            for (auto &t : r.timings)
+            {
+                fprintf(out, "%-12s %-7s %12llu %8llu %9.1f %9.3f  %s\n", r.name.c_str(), t.engine.c_str(),
+                    static_cast<unsigned long long>(r.instructions), static_cast<unsigned long long>(t.runs),
+                    mips(r, t), ns_per_instruction(r, t), t.ok ? "ok" : "WRONG");
+            }
+        }
+
+        fprintf(out, "\nopcode mix\n");
+        for (auto &r : results)
+        {
+            if (!r.error.empty())
+                continue;
+            std::vector<size_t> ops;
+            for (size_t op = 0; op < r.mix.size(); ++op)
+            {
+                if (r.mix[op] != 0)
+                    ops.push_back(op);
+            }
+            std::sort(ops.begin(), ops.end(), [&](size_t a, size_t b) { return r.mix[a] > r.mix[b]; });
+            fprintf(out, "%-12s", r.name.c_str());
+            for (auto op : ops)
+            {
+                fprintf(out, " %s %.1f%%", op_name(static_cast<op_codes>(op)), 100.0 * r.mix[op] / r.instructions);
+            }
+            fprintf(out, "\n");
+        }
+    }
+
+    void write_json(std::ostream &out, const std::vector<result> &results)
+    {
+#ifdef LC3_THREADED_DISPATCH
+        const char *dispatch = "threaded";
+#else
+        const char *dispatch = "switch";
+#endif
+        out << "{\n  \"dispatch\": \"" << dispatch << "\",\n  \"programs\": [";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            auto &r = results[i];
+            out << (i ? "," : "") << "\n    {\n      \"name\": " << quoted(r.name) << ",\n";
+            if (!r.error.empty())
+            {
+                out << "      \"error\": " << quoted(r.error) << "\n    }";
+                continue;
+            }
+            out << "      \"instructions\": " << r.instructions << ",\n      \"mix\": {";
+            bool first = true;
+            for (size_t op = 0; op < r.mix.size(); ++op)
+            {
+                if (r.mix[op] == 0)
+                    continue;
+                out << (first ? " " : ", ") << "\"" << op_name(static_cast<op_codes>(op)) << "\": " << r.mix[op];
+                first = false;
+            }
+            out << " },\n      \"engines\": [";
+            for (size_t j = 0; j < r.timings.size(); ++j)
+            {
+                auto &t = r.timings[j];
+                out << (j ? "," : "") << "\n        { \"engine\": " << quoted(t.engine)
+                    << ", \"ok\": " << (t.ok ? "true" : "false")
+                    << ", \"runs\": " << t.runs
+                    << ", \"seconds\": " << t.seconds
+                    << ", \"mips\": " << mips(r, t)
+                    << ", \"ns_per_instruction\": " << ns_per_instruction(r, t) << " }";
+            }
+            out << "\n      ]\n    }";
+        }
+        out << "\n  ]\n}\n";
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    // lc3-bench [--engine interp|plain|jit] [--farm threads] [--time seconds] [--trials n]
+    //           [--json file] [name|[--replay keys.log] program.obj...]
+    // plain is the interpreter without fused sequences; every --farm also
+    // runs the programs many at a time on a farm, MIPS are then the total
+    // over all threads
+    // with no programs named the whole corpus runs, an object file is timed
+    // but its output is not checked; --replay feeds the keys of a session
+    // recorded with lc3-vm --record to the object files after it
+    options opt;
+    std::vector<input_event> keys;
+    std::vector<benchmark> selected;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--engine" && i + 1 < argc)
+        {
+            std::string engine = argv[++i];
+            if (engine != "interp" && engine != "plain" && engine != "jit")
+            {
+                fprintf(stderr, "unknown engine %s\n", engine.c_str());
+                return 1;
+            }
+            opt.engines.push_back(engine);
+        }
+        else if (arg == "--farm" && i + 1 < argc)
+        {
+            opt.farms.push_back(std::max(1, atoi(argv[++i])));
+        }
+        else if (arg == "--time" && i + 1 < argc)
+        {
+            opt.min_time = atof(argv[++i]);
+        }
+        else if (arg == "--trials" && i + 1 < argc)
+        {
+            opt.trials = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            opt.json = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            keys.clear();
+            std::ifstream log(argv[++i]);
+            if (!log || !read_input_log(log, keys))
+            {
+                fprintf(stderr, "cannot read input log %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            auto &all = benchmarks();
+            auto found = std::find_if(all.begin(), all.end(), [&](const benchmark &b) { return arg == b.name; });
+            if (found != all.end())
+            {
+                selected.push_back(*found);
+                continue;
+            }
+            benchmark b = { argv[i], "", object_image(), "", keys };
+            std::ifstream file(arg, std::ios::binary);
+            if (!file || !read_object(file, b.image))
+            {
+                fprintf(stderr, "%s is neither a benchmark nor an object file\n", argv[i]);
+                return 1;
+            }
+            selected.push_back(b);
+        }
+    }
+    if (selected.empty())
+    {
+        selected = benchmarks();
+    }
+    if (opt.engines.empty() && opt.farms.empty())
+    {
+        opt.engines.push_back("interp");
+        opt.engines.push_back("plain");
+#ifdef LC3_JIT
+        opt.engines.push_back("jit");
+#endif
+    }
+
+    bool failed = false;
+    std::vector<result> results;
+    for (auto &b : selected)
+    {
+        result r;
+        r.name = b.name;
+        for (auto &engine : opt.engines)
+        {
+            if (!measure(b, engine, opt, r))
+                break;
+            failed |= !r.timings.back().ok;
+        }
+        for (auto threads : opt.farms)
+        {
+            if (!r.error.empty() || !measure_farm(b, threads, opt, r))
+                break;
+            failed |= !r.timings.back().ok;
+        }
+        failed |= !r.error.empty();
+        results.push_back(r);
+    }
+
+    report(stdout, results);
+    if (opt.json)
+    {
+        std::ofstream out(opt.json);
+        write_json(out, results);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+#include "programs.h"
+
+namespace
+{
+    // Fills x4000 with 400 words from x = 5x + 13849, insertion sorts them and
+    // checks the order.
+    const uint16_t sort_words[] =
+    {
+        0x2232,    // x3000         LD      R1, BASE
+        0x2433,    // x3001         LD      R2, COUNT
+        0x2633,    // x3002         LD      R3, SEED
+        0x2A34,    // x3003         LD      R5, MASK
+        0x18C3,    // x3004  FILL   ADD     R4, R3, R3
+        0x1904,    // x3005         ADD     R4, R4, R4
+        0x1703,    // x3006         ADD     R3, R4, R3
+        0x282F,    // x3007         LD      R4, INC
+        0x16C4,    // x3008         ADD     R3, R3, R4
+        0x58C5,    // x3009         AND     R4, R3, R5
+        0x7840,    // x300A         STR     R4, R1, #0
+        0x1261,    // x300B         ADD     R1, R1, #1
+        0x14BF,    // x300C         ADD     R2, R2, #-1
+        0x03F6,    // x300D         BRp     FILL
+        // insertion sort, R1 = &a[i]
+        0x2224,    // x300E         LD      R1, BASE
+        0x2425,    // x300F         LD      R2, COUNT
+        0x14BF,    // x3010         ADD     R2, R2, #-1
+        0x1261,    // x3011  OUTER  ADD     R1, R1, #1
+        0x6640,    // x3012         LDR     R3, R1, #0
+        0x98FF,    // x3013         NOT     R4, R3
+        0x1921,    // x3014         ADD     R4, R4, #1
+        0x1A60,    // x3015         ADD     R5, R1, #0
+        0x6D7F,    // x3016  INNER  LDR     R6, R5, #-1
+        0x1184,    // x3017         ADD     R0, R6, R4
+        0x0C05,    // x3018         BRnz    PLACE
+        0x7D40,    // x3019         STR     R6, R5, #0
+        0x1B7F,    // x301A         ADD     R5, R5, #-1
+        0x2018,    // x301B         LD      R0, NBASE
+        0x1140,    // x301C         ADD     R0, R5, R0
+        0x03F8,    // x301D         BRp     INNER
+        0x7740,    // x301E  PLACE  STR     R3, R5, #0
+        0x14BF,    // x301F         ADD     R2, R2, #-1
+        0x03F0,    // x3020         BRp     OUTER
+        // check the order
+        0x2211,    // x3021         LD      R1, BASE
+        0x2412,    // x3022         LD      R2, COUNT
+        0x14BF,    // x3023         ADD     R2, R2, #-1
+        0x6640,    // x3024  CHECK  LDR     R3, R1, #0
+        0x6841,    // x3025         LDR     R4, R1, #1
+        0x993F,    // x3026         NOT     R4, R4
+        0x1921,    // x3027         ADD     R4, R4, #1
+        0x18C4,    // x3028         ADD     R4, R3, R4
+        0x0206,    // x3029         BRp     BAD
+        0x1261,    // x302A         ADD     R1, R1, #1
+        0x14BF,    // x302B         ADD     R2, R2, #-1
+        0x03F7,    // x302C         BRp     CHECK
+        0xE00B,    // x302D         LEA     R0, OK
+        0xF022,    // x302E         PUTS
+        0xF025,    // x302F         HALT
+        0xE011,    // x3030  BAD    LEA     R0, BADS
+        0xF022,    // x3031         PUTS
+        0xF025,    // x3032         HALT
+        0x4000,    // x3033  BASE   .FILL   x4000
+        0xC000,    // x3034  NBASE  .FILL   xC000
+        0x0190,    // x3035  COUNT  .FILL   #400
+        0x3039,    // x3036  SEED   .FILL   #12345
+        0x3619,    // x3037  INC    .FILL   #13849
+        0x7FFF,    // x3038  MASK   .FILL   x7FFF
+        // x3039  OK     .STRINGZ "sort ok\n"
+        0x0073, 0x006F, 0x0072, 0x0074, 0x0020, 0x006F, 0x006B, 0x000A,
+        0x0000,
+        // x3042  BADS   .STRINGZ "sort bad\n"
+        0x0073, 0x006F, 0x0072, 0x0074, 0x0020, 0x0062, 0x0061, 0x0064,
+        0x000A, 0x0000,
+    };
+
+    // Sieve of Eratosthenes below 3000 in x5000, expects 430 primes.
+    const uint16_t sieve_words[] =
+    {
+        0x2227,    // x3000         LD      R1, BASE
+        0x2427,    // x3001         LD      R2, N
+        0x5020,    // x3002         AND     R0, R0, #0
+        0x7040,    // x3003  CLEAR  STR     R0, R1, #0
+        0x1261,    // x3004         ADD     R1, R1, #1
+        0x14BF,    // x3005         ADD     R2, R2, #-1
+        0x03FC,    // x3006         BRp     CLEAR
+        0x5920,    // x3007         AND     R4, R4, #0
+        0x54A0,    // x3008         AND     R2, R2, #0
+        0x14A2,    // x3009         ADD     R2, R2, #2
+        0x261F,    // x300A  OUTER  LD      R3, NEGN
+        0x1683,    // x300B         ADD     R3, R2, R3
+        0x0612,    // x300C         BRzp    FIN
+        0x221A,    // x300D         LD      R1, BASE
+        0x1242,    // x300E         ADD     R1, R1, R2
+        0x6640,    // x300F         LDR     R3, R1, #0
+        0x0A0C,    // x3010         BRnp    NEXT
+        0x1921,    // x3011         ADD     R4, R4, #1
+        0x1A82,    // x3012         ADD     R5, R2, R2
+        0x5DA0,    // x3013         AND     R6, R6, #0
+        0x1DA1,    // x3014         ADD     R6, R6, #1
+        0x2614,    // x3015  INNER  LD      R3, NEGN
+        0x1743,    // x3016         ADD     R3, R5, R3
+        0x0605,    // x3017         BRzp    NEXT
+        0x220F,    // x3018         LD      R1, BASE
+        0x1245,    // x3019         ADD     R1, R1, R5
+        0x7C40,    // x301A         STR     R6, R1, #0
+        0x1B42,    // x301B         ADD     R5, R5, R2
+        0x0FF8,    // x301C         BRnzp   INNER
+        0x14A1,    // x301D  NEXT   ADD     R2, R2, #1
+        0x0FEB,    // x301E         BRnzp   OUTER
+        0x260B,    // x301F  FIN    LD      R3, NEGP
+        0x1703,    // x3020         ADD     R3, R4, R3
+        0x0A03,    // x3021         BRnp    BAD
+        0xE009,    // x3022         LEA     R0, OK
+        0xF022,    // x3023         PUTS
+        0xF025,    // x3024         HALT
+        0xE010,    // x3025  BAD    LEA     R0, BADS
+        0xF022,    // x3026         PUTS
+        0xF025,    // x3027         HALT
+        0x5000,    // x3028  BASE   .FILL   x5000
+        0x0BB8,    // x3029  N      .FILL   #3000
+        0xF448,    // x302A  NEGN   .FILL   #-3000
+        0xFE52,    // x302B  NEGP   .FILL   #-430
+        // x302C  OK     .STRINGZ "sieve ok\n"
+        0x0073, 0x0069, 0x0065, 0x0076, 0x0065, 0x0020, 0x006F, 0x006B,
+        0x000A, 0x0000,
+        // x3036  BADS   .STRINGZ "sieve bad\n"
+        0x0073, 0x0069, 0x0065, 0x0076, 0x0065, 0x0020, 0x0062, 0x0061,
+        0x0064, 0x000A, 0x0000,
+    };
+
+    // Recursive fib(20) through JSR with a stack in R6, expects 6765.
+    const uint16_t fib_words[] =
+    {
+        0x2C20,    // x3000         LD      R6, STACK
+        0x5260,    // x3001         AND     R1, R1, #0
+        0x126A,    // x3002         ADD     R1, R1, #10
+        0x126A,    // x3003         ADD     R1, R1, #10
+        0x4809,    // x3004         JSR     FIB
+        0x261C,    // x3005         LD      R3, NEGF
+        0x1603,    // x3006         ADD     R3, R0, R3
+        0x0A03,    // x3007         BRnp    BAD
+        0xE01A,    // x3008         LEA     R0, OK
+        0xF022,    // x3009         PUTS
+        0xF025,    // x300A         HALT
+        0xE01F,    // x300B  BAD    LEA     R0, BADS
+        0xF022,    // x300C         PUTS
+        0xF025,    // x300D         HALT
+        // R0 = fib(R1)
+        0x1DBD,    // x300E  FIB    ADD     R6, R6, #-3
+        0x7F82,    // x300F         STR     R7, R6, #2
+        0x7381,    // x3010         STR     R1, R6, #1
+        0x7580,    // x3011         STR     R2, R6, #0
+        0x107E,    // x3012         ADD     R0, R1, #-2
+        0x0602,    // x3013         BRzp    REC
+        0x1060,    // x3014         ADD     R0, R1, #0
+        0x0E06,    // x3015         BRnzp   DONE
+        0x127F,    // x3016  REC    ADD     R1, R1, #-1
+        0x4FF6,    // x3017         JSR     FIB
+        0x1420,    // x3018         ADD     R2, R0, #0
+        0x127F,    // x3019         ADD     R1, R1, #-1
+        0x4FF3,    // x301A         JSR     FIB
+        0x1002,    // x301B         ADD     R0, R0, R2
+        0x6580,    // x301C  DONE   LDR     R2, R6, #0
+        0x6381,    // x301D         LDR     R1, R6, #1
+        0x6F82,    // x301E         LDR     R7, R6, #2
+        0x1DA3,    // x301F         ADD     R6, R6, #3
+        0xC1C0,    // x3020         RET
+        0xF000,    // x3021  STACK  .FILL   xF000
+        0xE593,    // x3022  NEGF   .FILL   #-6765
+        // x3023  OK     .STRINGZ "fib ok\n"
+        0x0066, 0x0069, 0x0062, 0x0020, 0x006F, 0x006B, 0x000A, 0x0000,
+        // x302B  BADS   .STRINGZ "fib bad\n"
+        0x0066, 0x0069, 0x0062, 0x0020, 0x0062, 0x0061, 0x0064, 0x000A,
+        0x0000,
+    };
+
+    // 100 times: copies MSG upper cased into BUF and PUTS it, then reverses it
+    // in place and PUTS it again.
+    const uint16_t strings_words[] =
+    {
+        0x2A29,    // x3000         LD      R5, TIMES
+        0xE22C,    // x3001  LOOP   LEA     R1, MSG
+        0xE457,    // x3002         LEA     R2, BUF
+        0x6640,    // x3003  COPY   LDR     R3, R1, #0
+        0x040C,    // x3004         BRz     ENDC
+        0x2825,    // x3005         LD      R4, NEGA
+        0x18C4,    // x3006         ADD     R4, R3, R4
+        0x0805,    // x3007         BRn     STORE
+        0x2823,    // x3008         LD      R4, NEGZ
+        0x18C4,    // x3009         ADD     R4, R3, R4
+        0x0202,    // x300A         BRp     STORE
+        0x2821,    // x300B         LD      R4, UP
+        0x16C4,    // x300C         ADD     R3, R3, R4
+        0x7680,    // x300D  STORE  STR     R3, R2, #0
+        0x1261,    // x300E         ADD     R1, R1, #1
+        0x14A1,    // x300F         ADD     R2, R2, #1
+        0x0FF2,    // x3010         BRnzp   COPY
+        0x56E0,    // x3011  ENDC   AND     R3, R3, #0
+        0x16EA,    // x3012         ADD     R3, R3, #10
+        0x7680,    // x3013         STR     R3, R2, #0
+        0x56E0,    // x3014         AND     R3, R3, #0
+        0x7681,    // x3015         STR     R3, R2, #1
+        0xE043,    // x3016         LEA     R0, BUF
+        0xF022,    // x3017         PUTS
+        // R1 and R2 walk in from both ends until they meet
+        0xE241,    // x3018         LEA     R1, BUF
+        0x14BF,    // x3019         ADD     R2, R2, #-1
+        0x967F,    // x301A  REV    NOT     R3, R1
+        0x16E1,    // x301B         ADD     R3, R3, #1
+        0x1683,    // x301C         ADD     R3, R2, R3
+        0x0C07,    // x301D         BRnz    ENDR
+        0x6640,    // x301E         LDR     R3, R1, #0
+        0x6880,    // x301F         LDR     R4, R2, #0
+        0x7840,    // x3020         STR     R4, R1, #0
+        0x7680,    // x3021         STR     R3, R2, #0
+        0x1261,    // x3022         ADD     R1, R1, #1
+        0x14BF,    // x3023         ADD     R2, R2, #-1
+        0x0FF5,    // x3024         BRnzp   REV
+        0xE034,    // x3025  ENDR   LEA     R0, BUF
+        0xF022,    // x3026         PUTS
+        0x1B7F,    // x3027         ADD     R5, R5, #-1
+        0x03D8,    // x3028         BRp     LOOP
+        0xF025,    // x3029         HALT
+        0x0064,    // x302A  TIMES  .FILL   #100
+        0xFF9F,    // x302B  NEGA   .FILL   #-97
+        0xFF86,    // x302C  NEGZ   .FILL   #-122
+        0xFFE0,    // x302D  UP     .FILL   #-32
+        // x302E  MSG    .STRINGZ "the quick brown fox jumps over the lazy dog"
+        0x0074, 0x0068, 0x0065, 0x0020, 0x0071, 0x0075, 0x0069, 0x0063,
+        0x006B, 0x0020, 0x0062, 0x0072, 0x006F, 0x0077, 0x006E, 0x0020,
+        0x0066, 0x006F, 0x0078, 0x0020, 0x006A, 0x0075, 0x006D, 0x0070,
+        0x0073, 0x0020, 0x006F, 0x0076, 0x0065, 0x0072, 0x0020, 0x0074,
+        0x0068, 0x0065, 0x0020, 0x006C, 0x0061, 0x007A, 0x0079, 0x0020,
+        0x0064, 0x006F, 0x0067, 0x0000,
+        // x305A  BUF    .BLKW   #64
+    };
+
+    template <size_t n>
+    object_image image(const uint16_t (&words)[n])
+    {
+        return { 0x3000, std::vector<uint16_t>(words, words + n) };
+    }
+
+    std::string strings_output()
+    {
+        std::string upper = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG";
+        std::string reversed(upper.rbegin(), upper.rend());
+        std::string out;
+        for (int i = 0; i < 100; ++i)
+        {
+            out += upper + "\n" + reversed + "\n";
+        }
+        return out;
+    }
+}
+
+const std::vector<benchmark> &benchmarks()
+{
+    static const std::vector<benchmark> all =
+    {
+        { "sort", "insertion sort of 400 words", image(sort_words), "sort ok\nHalted\n" },
+        { "sieve", "prime sieve below 3000", image(sieve_words), "sieve ok\nHalted\n" },
+        { "fib", "recursive fib(20) through JSR", image(fib_words), "fib ok\nHalted\n" },
+        { "strings", "upper case, reverse and PUTS", image(strings_words), strings_output() + "Halted\n" }
+    };
+    return all;
+}
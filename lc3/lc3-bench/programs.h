@@ -0,0 +1,25 @@
+#ifndef __programs_h__
+#define __programs_h__
+
+#include "../lc3-vm/object.h"
+#include "../lc3-vm/replay.h"
+
+#include <string>
+#include <vector>
+
+// A deterministic program. The words of the corpus are assembled into
+// programs.cpp with the listing next to them; every program checks its own
+// result and prints ok or bad. Object files named on the command line can
+// bring a recorded session to replay as their input.
+struct benchmark
+{
+    const char *name;
+    const char *description;
+    object_image image;
+    std::string expected;   // all of its output, HALT included
+    std::vector<input_event> keys;
+};
+
+const std::vector<benchmark> &benchmarks();
+
+#endif // __programs_h__
@@ -0,0 +1,269 @@
+#include "../lc3-vm/vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+
+namespace
+{
+    typedef std::chrono::steady_clock grade_clock;
+
+    const char *reasons[] = { "budget", "halted", "blocked", "illegal", "breakpoint", "watchpoint", "paused" };
+
+    // <name>.in holds the keys of a case, <name>.out the output expected of
+    // it and <name>.budget, if there is one, its own instruction budget
+    struct grade_case
+    {
+        std::string name;
+        std::string keys;
+        std::string expected;
+        bool checked = false;
+        uint64_t budget = 0;
+
+        std::string output;
+        exit_reason reason = exit_reason::budget;
+        uint64_t executed = 0;
+        double seconds = 0;
+        bool passed = false;
+    };
+
+    bool read_file(const std::string &path, std::string &data)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // expected outputs are often saved with CRLF, the vm only writes LF
+    std::string unix_lines(const std::string &text)
+    {
+        std::string out;
+        out.reserve(text.size());
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] != '\r' || i + 1 == text.size() || text[i + 1] != '\n')
+                out += text[i];
+        }
+        return out;
+    }
+
+    std::vector<std::string> input_files(const std::string &dir)
+    {
+        std::vector<std::string> names;
+        auto take = [&names](const std::string &file)
+        {
+            if (file.size() > 3 && file.compare(file.size() - 3, 3, ".in") == 0)
+                names.push_back(file.substr(0, file.size() - 3));
+        };
+#ifdef _WIN32
+        WIN32_FIND_DATAA found;
+        auto find = FindFirstFileA((dir + "\\*.in").c_str(), &found);
+        if (find != INVALID_HANDLE_VALUE)
+        {
+            do
+            {
+                take(found.cFileName);
+            } while (FindNextFileA(find, &found));
+            FindClose(find);
+        }
+#else
+        if (auto d = opendir(dir.c_str()))
+        {
+            while (auto entry = readdir(d))
+            {
+                take(entry->d_name);
+            }
+            closedir(d);
+        }
+#endif
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    bool load_cases(const std::string &dir, uint64_t budget, std::vector<grade_case> &cases)
+    {
+        for (auto &name : input_files(dir))
+        {
+            grade_case c;
+            c.name = name;
+            auto base = dir + "/" + name;
+            if (!read_file(base + ".in", c.keys))
+            {
+                std::cerr << "cannot read " << base << ".in" << std::endl;
+                return false;
+            }
+            c.checked = read_file(base + ".out", c.expected);
+            c.expected = unix_lines(c.expected);
+            std::string own;
+            c.budget = read_file(base + ".budget", own) ? strtoull(own.c_str(), nullptr, 10) : 0;
+            if (c.budget == 0)
+                c.budget = budget;
+            cases.push_back(std::move(c));
+        }
+        return true;
+    }
+
+    // One vm per thread, each case starts from the snapshot taken after
+    // loading, whose decoded pages every vm reads rather than decoding its
+    // own. Cases are handed out one at a time so long ones do not hold up
+    // a whole share of the rest.
+    void grade(const vm_snapshot &start, bool jit, std::vector<grade_case> &cases, std::atomic<size_t> &next)
+    {
+        auto out = new capture_sink();
+        vm machine(std::unique_ptr<input_source>(new queued_input()),
+            std::unique_ptr<output_buffer>(new output_buffer(std::unique_ptr<output_sink>(out))));
+        machine.use_jit(jit);
+        for (size_t i = next++; i < cases.size(); i = next++)
+        {
+            auto &c = cases[i];
+            auto keys = new queued_input();
+            keys->push(c.keys);
+            keys->close();
+            machine.set_input(std::unique_ptr<input_source>(keys));
+            machine.restore(start);
+            out->clear();
+
+            auto begin = grade_clock::now();
+            c.reason = machine.run_for(c.budget);
+            machine.output().flush();
+            c.seconds = std::chrono::duration<double>(grade_clock::now() - begin).count();
+
+            c.executed = machine.executed();
+            c.output = out->str();
+            // a program that asks for more input than the case has is done
+            // with it, what it printed so far is still graded
+            bool finished = c.reason == exit_reason::halted || c.reason == exit_reason::blocked;
+            c.passed = finished && (!c.checked || c.output == c.expected);
+        }
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    // lc3-grade [--threads n] [--budget n] [--jit] [--show] program.obj cases/
+    // runs program once for every <name>.in in cases/ and compares what it
+    // prints with <name>.out; --show prints the output of failed cases
+    const char *program = nullptr;
+    const char *dir = nullptr;
+    size_t threads = 0;
+    uint64_t budget = 10000000;
+    bool jit = false;
+    bool show = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            threads = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--budget" && i + 1 < argc)
+        {
+            budget = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--jit")
+        {
+            jit = true;
+        }
+        else if (arg == "--show")
+        {
+            show = true;
+        }
+        else if (!program)
+        {
+            program = argv[i];
+        }
+        else if (!dir)
+        {
+            dir = argv[i];
+        }
+        else
+        {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (!program || !dir)
+    {
+        std::cerr << "usage: lc3-grade [--threads n] [--budget n] [--jit] [--show] program.obj cases/" << std::endl;
+        return 1;
+    }
+
+    object_set objects;
+    if (!objects.add(program))
+    {
+        std::cerr << objects.error() << std::endl;
+        return 1;
+    }
+    std::vector<grade_case> cases;
+    if (!load_cases(dir, budget, cases))
+        return 1;
+    if (cases.empty())
+    {
+        std::cerr << "no cases in " << dir << std::endl;
+        return 1;
+    }
+
+    // loaded and decoded once, every case restores this
+    vm_snapshot start;
+    {
+        vm loader(std::unique_ptr<input_source>(new queued_input()),
+            std::unique_ptr<output_buffer>(new output_buffer(std::unique_ptr<output_sink>(new capture_sink()))));
+        loader.load(objects);
+        loader.set_entry(objects.entry());
+        loader.reset();
+        start = loader.snapshot();
+        start.decoded = predecode(*start.memory);
+    }
+
+    if (threads == 0)
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    threads = std::min(threads, cases.size());
+    std::atomic<size_t> next(0);
+    auto begin = grade_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back(grade, std::cref(start), jit, std::ref(cases), std::ref(next));
+    }
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+    double wall = std::chrono::duration<double>(grade_clock::now() - begin).count();
+
+    size_t passed = 0;
+    double busy = 0;
+    for (auto &c : cases)
+    {
+        printf("%-24s %-4s %-8s %12llu instructions %9.3f ms\n", c.name.c_str(),
+            c.passed ? (c.checked ? "pass" : "ran") : "FAIL", reasons[static_cast<int>(c.reason)],
+            static_cast<unsigned long long>(c.executed), c.seconds * 1e3);
+        if (show && !c.passed)
+        {
+            printf("--- expected\n%s\n--- got\n%s\n---\n", c.expected.c_str(), c.output.c_str());
+        }
+        passed += c.passed;
+        busy += c.seconds;
+    }
+    printf("%zu of %zu cases passed in %.3f s on %zu threads (%.3f s in the vm), %.0f cases/s\n",
+        passed, cases.size(), wall, threads, busy, cases.size() / wall);
+    return passed == cases.size() ? 0 : 1;
+}
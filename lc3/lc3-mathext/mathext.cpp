@@ -0,0 +1,71 @@
+// Sample native extension: multiply, divide and block copy on the reserved
+// opcode, for programs that would otherwise loop for them.
+//
+//   1101 DR SR1 fn SR2
+//
+//   fn 0  MUL   DR = SR1 * SR2
+//   fn 1  DIV   DR = SR1 / SR2, signed, 0 when SR2 is 0
+//   fn 2  MOD   DR = SR1 % SR2, signed, 0 when SR2 is 0
+//   fn 3  COPY  copies SR2 words from [SR1] to [DR], overlapping or not
+//
+// MUL, DIV and MOD set the condition codes from DR.
+
+#include "../lc3-vm/lc3_native.h"
+
+#include <string.h>
+
+namespace
+{
+    void set_cc(lc3_context *ctx, uint16_t value)
+    {
+        ctx->regs[LC3_CC] = value == 0 ? LC3_CC_Z : (value & 0x8000) ? LC3_CC_N : LC3_CC_P;
+    }
+}
+
+LC3_NATIVE_API int lc3_native_version(void)
+{
+    return LC3_NATIVE_VERSION;
+}
+
+LC3_NATIVE_API void lc3_execute(lc3_context *ctx)
+{
+    auto inst = ctx->instruction;
+    auto &dr = ctx->regs[(inst >> 9) & 7];
+    auto a = ctx->regs[(inst >> 6) & 7];
+    auto b = ctx->regs[inst & 7];
+    auto sa = static_cast<int16_t>(a);
+    auto sb = static_cast<int16_t>(b);
+
+    switch ((inst >> 3) & 7)
+    {
+    case 0:
+        dr = static_cast<uint16_t>(a * b);
+        set_cc(ctx, dr);
+        break;
+    case 1:
+        dr = sb == 0 ? 0 : static_cast<uint16_t>(sa / sb);
+        set_cc(ctx, dr);
+        break;
+    case 2:
+        dr = sb == 0 ? 0 : static_cast<uint16_t>(sa % sb);
+        set_cc(ctx, dr);
+        break;
+    case 3:
+        // ranges that wrap past xFFFF are copied forward a word at a time
+        if (static_cast<uint32_t>(dr) + b <= 0x10000 && static_cast<uint32_t>(a) + b <= 0x10000)
+        {
+            memmove(ctx->memory + dr, ctx->memory + a, b * sizeof(uint16_t));
+        }
+        else
+        {
+            for (uint16_t i = 0; i < b; ++i)
+            {
+                ctx->memory[static_cast<uint16_t>(dr + i)] = ctx->memory[static_cast<uint16_t>(a + i)];
+            }
+        }
+        ctx->written(ctx, dr, b);
+        break;
+    default:
+        break;
+    }
+}
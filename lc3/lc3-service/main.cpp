@@ -0,0 +1,269 @@
+#include "service.h"
+#include "../../npp/npp_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace
+{
+#ifdef _WIN32
+    const char *default_pipe = "\\\\.\\pipe\\lc3-service";
+#else
+    const char *default_pipe = "/tmp/lc3-service";
+#endif
+
+    const char *reasons[] = { "budget", "halted", "blocked", "illegal", "breakpoint", "watchpoint", "paused" };
+
+    // clients connected at once, pipe instances on Windows
+    const int max_clients = 255;
+
+    void serve_client(npp_server &client, lc3_service &service)
+    {
+        try
+        {
+            io_event stopped;   // never set, the session ends with the connection
+            {
+                service_session session(service);
+                ssp_parser parser(client, session);
+                parser.run(stopped);
+            }
+            client.disconnect();
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "client dropped: " << e.what() << std::endl;
+        }
+    }
+
+    int serve(const char *pipe, size_t pool, size_t images, uint64_t budget, bool once)
+    {
+        npp_server srv(pipe, once ? 1 : max_clients);
+        lc3_service service(pool, images, budget);
+        std::cerr << "lc3-service on " << pipe << std::endl;
+
+        // the service runs until it is killed, every client on a thread of
+        // its own
+        for (;;)
+        {
+            if (!srv.wait_for_client(INFINITE))
+                continue;
+            if (once)
+            {
+                serve_client(srv, service);
+                return 0;
+            }
+            std::shared_ptr<npp_server> client(srv.detach_client());
+            std::thread([client, &service] { serve_client(*client, service); }).detach();
+        }
+    }
+
+    void frame(std::string &batch, unsigned char fc, const std::string &payload)
+    {
+        for (size_t at = 0; at == 0 || at < payload.size(); at += SSP_MAX_PAYLOAD)
+        {
+            message m;
+            m.function(fc);
+            auto part = payload.substr(at, SSP_MAX_PAYLOAD);
+            m.push_back(part.data(), static_cast<int>(part.size()));
+            m.package();
+            batch.append(reinterpret_cast<const char *>(m.c_ptr()), m.size());
+        }
+    }
+
+    std::string u32(uint32_t value)
+    {
+        std::string out;
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<char>(value >> (i * 8)));
+        return out;
+    }
+
+    // splits what the service writes back into frames
+    class reply_reader
+    {
+    public:
+        explicit reply_reader(npp_client &client)
+            : client_(client)
+        {
+        }
+
+        bool next(unsigned char &fc, std::string &payload)
+        {
+            while (buffer_.size() < SSP_HEADER || buffer_.size() < static_cast<uint8_t>(buffer_[3]))
+            {
+                unsigned char chunk[4096];
+                int read = client_.read(chunk, sizeof(chunk), INFINITE);
+                if (read <= 0)
+                    return false;
+                buffer_.append(reinterpret_cast<char *>(chunk), read);
+            }
+            auto size = static_cast<uint8_t>(buffer_[3]);
+            fc = static_cast<unsigned char>(buffer_[4]);
+            payload.assign(buffer_, SSP_HEADER, size - SSP_HEADER);
+            buffer_.erase(0, size);
+            return true;
+        }
+
+    private:
+        npp_client &client_;
+        std::string buffer_;
+    };
+
+    int submit(const char *pipe, const char *path, const std::string &keys, uint64_t jobs, uint32_t budget)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "cannot open " << path << std::endl;
+            return 1;
+        }
+        std::string object((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        npp_client client(pipe);
+        reply_reader replies(client);
+        std::string batch;
+        frame(batch, FN_LC3_IMAGE, object);
+        frame(batch, FN_LC3_LOAD, "");
+
+        // every job is reset, feed and run in one write, with a window of
+        // jobs in flight so the pipe never sits idle
+        std::string job;
+        frame(job, FN_LC3_RESET, "");
+        if (!keys.empty())
+            frame(job, FN_LC3_FEED, keys);
+        frame(job, FN_LC3_RUN, u32(budget));
+        const uint64_t window = 64;
+
+        auto begin = std::chrono::steady_clock::now();
+        uint64_t sent = 0;
+        uint64_t done = 0;
+        std::string output;
+        std::string last;
+        unsigned char fc;
+        std::string payload;
+        while (done < jobs)
+        {
+            for (; sent < jobs && sent - done < window; ++sent)
+                batch += job;
+            if (!batch.empty())
+            {
+                client.write(reinterpret_cast<const unsigned char *>(batch.data()), static_cast<int>(batch.size()), INFINITE);
+                batch.clear();
+            }
+            if (!replies.next(fc, payload))
+            {
+                std::cerr << "service went away" << std::endl;
+                return 1;
+            }
+            if (fc == FN_LC3_ERROR)
+            {
+                std::cerr << "error: " << payload << std::endl;
+                return 1;
+            }
+            if (fc == FN_LC3_OUTPUT)
+            {
+                output += payload;
+            }
+            else if (fc == FN_LC3_STATUS)
+            {
+                if (done == 0)
+                {
+                    std::cout << output;
+                    auto reason = static_cast<uint8_t>(payload[0]);
+                    uint64_t executed = 0;
+                    for (int i = 8; i > 0; --i)
+                        executed = executed << 8 | static_cast<uint8_t>(payload[i]);
+                    std::cerr << (reason < 7 ? reasons[reason] : "?") << " after " << executed << " instructions" << std::endl;
+                }
+                else if (output != last)
+                {
+                    std::cerr << "job " << done << " gave different output" << std::endl;
+                    return 1;
+                }
+                last.swap(output);
+                output.clear();
+                ++done;
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::cerr << jobs << " jobs in " << seconds << "s, " << static_cast<uint64_t>(jobs / seconds) << " jobs/s" << std::endl;
+        return 0;
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    // lc3-service [--pipe name] [--pool n] [--images n] [--budget n] [--once]
+    // lc3-service --submit program.obj [--pipe name] [--input keys] [--jobs n] [--budget n]
+    // serves jobs from many clients at once, --once from the first client
+    // only; --submit runs a program as n jobs on a running service and
+    // prints the output of the first
+    const char *pipe = default_pipe;
+    const char *program = nullptr;
+    std::string keys;
+    size_t pool = 8;
+    size_t images = 64;
+    uint64_t budget = 0;    // the service runs jobs for 100M instructions
+    uint64_t jobs = 1;
+    bool once = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--pipe" && i + 1 < argc)
+        {
+            pipe = argv[++i];
+        }
+        else if (arg == "--pool" && i + 1 < argc)
+        {
+            pool = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--images" && i + 1 < argc)
+        {
+            images = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--budget" && i + 1 < argc)
+        {
+            budget = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--once")
+        {
+            once = true;
+        }
+        else if (arg == "--submit" && i + 1 < argc)
+        {
+            program = argv[++i];
+        }
+        else if (arg == "--input" && i + 1 < argc)
+        {
+            keys = argv[++i];
+        }
+        else if (arg == "--jobs" && i + 1 < argc)
+        {
+            jobs = strtoull(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        if (program)
+            return submit(pipe, program, keys, jobs, static_cast<uint32_t>(budget));
+        return serve(pipe, pool, images, budget ? budget : 100000000, once);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
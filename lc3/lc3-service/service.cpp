@@ -0,0 +1,325 @@
+#include "service.h"
+
+#include "../lc3-vm/object.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace
+{
+    uint32_t get32(const char *data)
+    {
+        auto bytes = reinterpret_cast<const uint8_t *>(data);
+        return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+
+    void put(std::string &out, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i)
+        {
+            out.push_back(static_cast<char>(value >> (i * 8)));
+        }
+    }
+}
+
+void job_input::push(const char *keys, size_t count)
+{
+    if (next_ == keys_.size())
+    {
+        keys_.clear();
+        next_ = 0;
+    }
+    keys_.append(keys, count);
+    arrived();
+}
+
+void job_input::clear()
+{
+    keys_.clear();
+    next_ = 0;
+}
+
+bool job_input::ready()
+{
+    return next_ < keys_.size();
+}
+
+bool job_input::poll(uint16_t &key)
+{
+    if (next_ == keys_.size())
+        return false;
+    key = static_cast<uint8_t>(keys_[next_++]);
+    return true;
+}
+
+bool job_input::wait()
+{
+    return ready();
+}
+
+void relay_sink::write(const char *data, size_t size)
+{
+    if (target_)
+        target_(data, size);
+}
+
+void relay_sink::set_target(std::function<void(const char *, size_t)> target)
+{
+    target_ = std::move(target);
+}
+
+warm_vm::warm_vm()
+    : input(new job_input()), output(new relay_sink()),
+    machine(std::unique_ptr<input_source>(input),
+        std::unique_ptr<output_buffer>(new output_buffer(std::unique_ptr<output_sink>(output)))),
+    image(nullptr)
+{
+}
+
+lc3_service::lc3_service(size_t pool_size, size_t image_limit, uint64_t budget)
+    : pool_size_(std::max<size_t>(1, pool_size)), image_limit_(std::max<size_t>(1, image_limit)),
+    budget_(budget), next_id_(0)
+{
+    for (size_t i = 0; i < pool_size_; ++i)
+    {
+        idle_.emplace_back(new warm_vm());
+    }
+    blank_ = idle_.front()->machine.snapshot();
+}
+
+std::shared_ptr<const service_image> lc3_service::add_image(const std::string &object, std::string &error)
+{
+    auto image = std::make_shared<service_image>();
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto found = by_object_.find(object);
+        if (found != by_object_.end())
+        {
+            use(found->second);
+            return found->second->image;
+        }
+        image->id = next_id_++;
+    }
+
+    object_image words;
+    std::istringstream stream(object);
+    if (!read_object(stream, words) || words.words.empty())
+    {
+        error = "not an object file";
+        return nullptr;
+    }
+
+    // the vm that loads an image is the first one warm for it
+    auto loader = acquire(nullptr);
+    loader->machine.restore(blank_);
+    loader->machine.load(words);
+    loader->machine.set_entry(words.origin);
+    loader->machine.reset();
+    image->start = loader->machine.snapshot();
+    loader->image = image;
+    release(std::move(loader));
+
+    std::lock_guard<std::mutex> lock(lock_);
+    auto found = by_object_.find(object);
+    if (found != by_object_.end())
+    {
+        // another connection loaded the same file meanwhile
+        use(found->second);
+        return found->second->image;
+    }
+    auto key = by_object_.emplace(object, images_.end()).first;
+    auto entry = images_.insert(images_.end(), { &key->first, image });
+    key->second = entry;
+    by_id_[image->id] = entry;
+    if (images_.size() > image_limit_)
+    {
+        auto oldest = images_.begin();
+        by_id_.erase(oldest->image->id);
+        by_object_.erase(*oldest->object);
+        images_.pop_front();
+    }
+    return image;
+}
+
+std::shared_ptr<const service_image> lc3_service::find_image(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    auto found = by_id_.find(id);
+    if (found == by_id_.end())
+        return nullptr;
+    use(found->second);
+    return found->second->image;
+}
+
+void lc3_service::use(cache_entry entry)
+{
+    images_.splice(images_.end(), images_, entry);
+}
+
+std::unique_ptr<warm_vm> lc3_service::acquire(const service_image *image)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (idle_.empty())
+        return std::unique_ptr<warm_vm>(new warm_vm());
+    auto warm = std::find_if(idle_.begin(), idle_.end(), [image](const std::unique_ptr<warm_vm> &w) { return w->image.get() == image; });
+    if (image == nullptr || warm == idle_.end())
+        warm = idle_.begin();
+    auto machine = std::move(*warm);
+    idle_.erase(warm);
+    return machine;
+}
+
+void lc3_service::release(std::unique_ptr<warm_vm> machine)
+{
+    machine->output->set_target(nullptr);
+    std::lock_guard<std::mutex> lock(lock_);
+    idle_.push_back(std::move(machine));
+    if (idle_.size() > pool_size_)
+        idle_.pop_front();
+}
+
+uint64_t lc3_service::budget() const
+{
+    return budget_;
+}
+
+service_session::service_session(lc3_service &service)
+    : service_(service), image_(nullptr)
+{
+}
+
+service_session::~service_session()
+{
+    if (vm_)
+        service_.release(std::move(vm_));
+}
+
+void service_session::on_function(ssp_parser *rsp, unsigned char fc, const char *payload, int size)
+{
+    switch (fc)
+    {
+    case FN_LC3_IMAGE:
+        upload_.append(payload, size);
+        break;
+    case FN_LC3_LOAD:
+        load(rsp, payload, size);
+        break;
+    case FN_LC3_RESET:
+        if (image_ == nullptr)
+            error(rsp, "no image loaded");
+        else
+            start();
+        break;
+    case FN_LC3_FEED:
+        if (vm_ == nullptr)
+            error(rsp, "no image loaded");
+        else
+            vm_->input->push(payload, size);
+        break;
+    case FN_LC3_RUN:
+        run(rsp, payload, size);
+        break;
+    case FN_LC3_FETCH:
+        fetch(rsp);
+        break;
+    default:
+        error(rsp, "unknown function");
+        break;
+    }
+}
+
+void service_session::load(ssp_parser *rsp, const char *payload, int size)
+{
+    std::shared_ptr<const service_image> image;
+    if (size >= 4)
+    {
+        image = service_.find_image(get32(payload));
+        if (image == nullptr)
+        {
+            error(rsp, "no such image");
+            return;
+        }
+    }
+    else
+    {
+        std::string why;
+        image = service_.add_image(upload_, why);
+        upload_.clear();
+        if (image == nullptr)
+        {
+            error(rsp, why.c_str());
+            return;
+        }
+    }
+
+    if (vm_ && vm_->image != image)
+        service_.release(std::move(vm_));
+    if (!vm_)
+        vm_ = service_.acquire(image.get());
+    image_ = image;
+    start();
+
+    std::string loaded;
+    put(loaded, image->id, 4);
+    rsp->send(FN_LC3_LOADED, loaded.data(), static_cast<int>(loaded.size()));
+}
+
+void service_session::start()
+{
+    vm_->machine.restore(image_->start);
+    vm_->image = image_;
+    vm_->input->clear();
+    held_.clear();
+}
+
+void service_session::run(ssp_parser *rsp, const char *payload, int size)
+{
+    if (vm_ == nullptr)
+    {
+        error(rsp, "no image loaded");
+        return;
+    }
+    uint64_t budget = size >= 4 ? get32(payload) : 0;
+    bool hold = size >= 5 && (payload[4] & LC3_RUN_HOLD) != 0;
+    if (budget == 0)
+        budget = service_.budget();
+
+    vm_->output->set_target([this, rsp, hold](const char *data, size_t count)
+    {
+        if (hold)
+            held_.append(data, count);
+        else
+            send_output(rsp, data, count);
+    });
+    auto reason = vm_->machine.run_for(budget);
+    vm_->machine.output().flush();
+    vm_->output->set_target(nullptr);
+
+    std::string status;
+    put(status, static_cast<uint8_t>(reason), 1);
+    put(status, vm_->machine.executed(), 8);
+    rsp->send(FN_LC3_STATUS, status.data(), static_cast<int>(status.size()));
+}
+
+void service_session::fetch(ssp_parser *rsp)
+{
+    send_output(rsp, held_.data(), held_.size());
+    held_.clear();
+    rsp->send(FN_LC3_DONE, "", 0);
+}
+
+void service_session::send_output(ssp_parser *rsp, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        auto part = std::min<size_t>(size, SSP_MAX_PAYLOAD);
+        rsp->send(FN_LC3_OUTPUT, data, static_cast<int>(part));
+        data += part;
+        size -= part;
+    }
+}
+
+void service_session::error(ssp_parser *rsp, const char *message)
+{
+    rsp->send(FN_LC3_ERROR, message, static_cast<int>(strlen(message)));
+}
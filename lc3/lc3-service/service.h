@@ -0,0 +1,155 @@
+#ifndef __service_h__
+#define __service_h__
+
+#include "../lc3-vm/vm.h"
+#include "../../npp/ssp_parser.h"
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Function codes of the LC-3 service, on top of the SSP framing of npp.
+// Numbers in payloads are little endian. Requests that succeed only answer
+// when they have something to say, so a client can send a whole job in one
+// write; a request that fails answers FN_LC3_ERROR.
+#define FN_LC3_IMAGE    0x10    // the next part of an object file
+#define FN_LC3_LOAD     0x11    // loads what was uploaded, or the image id (u32)
+                                // given while the service still keeps it, and
+                                // starts a job on it
+#define FN_LC3_RESET    0x12    // starts a new job on the loaded image
+#define FN_LC3_FEED     0x13    // keys for GETC/IN
+#define FN_LC3_RUN      0x14    // budget (u32, 0 for the service default) and
+                                // flags (u8, optional)
+#define FN_LC3_FETCH    0x15    // output the job held back
+
+#define FN_LC3_LOADED   0x20    // image id (u32)
+#define FN_LC3_OUTPUT   0x21    // output of the job, in order
+#define FN_LC3_STATUS   0x22    // exit_reason (u8), instructions of the job (u64)
+#define FN_LC3_DONE     0x23    // the end of a fetch
+#define FN_LC3_ERROR    0x2F    // what went wrong
+
+// FN_LC3_RUN flag: keep the output for FN_LC3_FETCH instead of streaming it
+#define LC3_RUN_HOLD    0x01
+
+// Keys of one job. The service runs a job only as far as its keys go, so
+// this never waits: GETC without a key leaves the vm blocked.
+class job_input : public input_source
+{
+public:
+    void push(const char *keys, size_t count);
+    void clear();
+
+    bool ready() override;
+    bool poll(uint16_t &key) override;
+    bool wait() override;
+
+private:
+    std::string keys_;
+    size_t next_ = 0;
+};
+
+// Hands flushed output to whoever runs the vm.
+class relay_sink : public output_sink
+{
+public:
+    void write(const char *data, size_t size) override;
+    void set_target(std::function<void(const char *, size_t)> target);
+
+private:
+    std::function<void(const char *, size_t)> target_;
+};
+
+// A loaded program, as the snapshot of a vm that has just loaded it.
+struct service_image
+{
+    uint32_t id;
+    vm_snapshot start;
+};
+
+// A vm kept between jobs. A job starts by restoring the image snapshot,
+// which only copies the pages the last job dirtied, so the decoded (and
+// compiled) code of every other page carries over.
+struct warm_vm
+{
+    warm_vm();
+
+    job_input *input;
+    relay_sink *output;
+    vm machine;
+    std::shared_ptr<const service_image> image;     // the one it ran last
+};
+
+// The images and the idle vms every connection shares, each connection
+// runs on a thread of its own. The vms are made up front, so no job pays for
+// mapping memory or allocating caches. Only the image_limit images used
+// last are kept; a connection holds on to the one it loaded.
+class lc3_service
+{
+public:
+    lc3_service(size_t pool_size, size_t image_limit, uint64_t budget);
+
+    // the image of an object file, loaded once per distinct file while it
+    // is kept; nullptr if the file is bad
+    std::shared_ptr<const service_image> add_image(const std::string &object, std::string &error);
+    std::shared_ptr<const service_image> find_image(uint32_t id);
+
+    // an idle vm that ran image last if there is one, else the one idle the
+    // longest
+    std::unique_ptr<warm_vm> acquire(const service_image *image);
+    void release(std::unique_ptr<warm_vm> machine);
+    uint64_t budget() const;
+
+private:
+    struct cached_image
+    {
+        const std::string *object;      // the key in by_object_
+        std::shared_ptr<const service_image> image;
+    };
+    typedef std::list<cached_image>::iterator cache_entry;
+
+    void use(cache_entry entry);
+
+private:
+    size_t pool_size_;
+    size_t image_limit_;
+    uint64_t budget_;
+    vm_snapshot blank_;     // zeroed memory, for loading new images
+    std::mutex lock_;       // everything below
+    uint32_t next_id_;
+    std::list<cached_image> images_;    // least recently used first
+    std::unordered_map<std::string, cache_entry> by_object_;
+    std::unordered_map<uint32_t, cache_entry> by_id_;
+    std::deque<std::unique_ptr<warm_vm>> idle_;     // least recently used first
+};
+
+// One client connection, running its jobs on the thread that reads it.
+class service_session : public ssp_parser::callbacks
+{
+public:
+    explicit service_session(lc3_service &service);
+    ~service_session();
+
+    void on_function(ssp_parser *rsp, unsigned char fc, const char *payload, int size) override;
+
+private:
+    void load(ssp_parser *rsp, const char *payload, int size);
+    void start();
+    void run(ssp_parser *rsp, const char *payload, int size);
+    void fetch(ssp_parser *rsp);
+    void send_output(ssp_parser *rsp, const char *data, size_t size);
+    void error(ssp_parser *rsp, const char *message);
+
+private:
+    lc3_service &service_;
+    std::string upload_;
+    std::shared_ptr<const service_image> image_;
+    std::unique_ptr<warm_vm> vm_;
+    std::string held_;
+};
+
+#endif // __service_h__
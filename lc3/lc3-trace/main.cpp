@@ -0,0 +1,121 @@
+
+#include "../lc3-vm/assembler.h"
+#include "../lc3-vm/decode_cache.h"
+#include "../lc3-vm/disasm.h"
+#include "../lc3-vm/trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // what the record says beyond the instruction itself
+    std::string effect(const trace_record &r)
+    {
+        auto d = decode(r.inst);
+        char buf[48];
+        switch (d.op)
+        {
+        case op_codes::op_add:
+        case op_codes::op_and:
+        case op_codes::op_not:
+        case op_codes::op_lea:
+            snprintf(buf, sizeof(buf), "R%d=x%04X", d.dr, r.value);
+            break;
+        case op_codes::op_ld:
+        case op_codes::op_ldi:
+        case op_codes::op_ldr:
+            snprintf(buf, sizeof(buf), "R%d=x%04X [x%04X]", d.dr, r.value, r.address);
+            break;
+        case op_codes::op_st:
+        case op_codes::op_sti:
+        case op_codes::op_str:
+            snprintf(buf, sizeof(buf), "[x%04X]=x%04X", r.address, r.value);
+            break;
+        case op_codes::op_br:
+        case op_codes::op_jmp:
+        case op_codes::op_jsr:
+        case op_codes::op_rti:
+            snprintf(buf, sizeof(buf), "-> x%04X", r.value);
+            break;
+        case op_codes::op_trap:
+            snprintf(buf, sizeof(buf), "R0=x%04X", r.value);
+            break;
+        default:
+            buf[0] = 0;
+            break;
+        }
+        return buf;
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    // lc3-trace <trace> [count] [program.asm]
+    // with the source of the program, addresses are shown after its labels
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: lc3-trace <trace> [count] [program.asm]\n");
+        return 1;
+    }
+    assembly source;
+    if (argc > 3)
+    {
+        std::ifstream in(argv[3]);
+        std::stringstream text;
+        text << in.rdbuf();
+        if (!in || !assemble(text.str(), source))
+        {
+            fprintf(stderr, "cannot assemble %s\n", argv[3]);
+            return 1;
+        }
+    }
+    auto symbols = source.symbols.empty() ? nullptr : &source.symbols;
+
+    FILE *file = nullptr;
+#ifdef _WIN32
+    fopen_s(&file, argv[1], "rb");
+#else
+    file = fopen(argv[1], "rb");
+#endif
+    char magic[sizeof(trace_magic)];
+    if (file == nullptr || fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, trace_magic, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a trace\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<trace_record> records;
+    trace_record chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, sizeof(trace_record), 4096, file)) > 0)
+    {
+        records.insert(records.end(), chunk, chunk + n);
+    }
+    fclose(file);
+
+    // the last count records, all of them by default
+    size_t first = 0;
+    if (argc > 2)
+    {
+        auto count = strtoull(argv[2], nullptr, 0);
+        first = records.size() > count ? records.size() - count : 0;
+    }
+    for (size_t i = first; i < records.size(); ++i)
+    {
+        auto &r = records[i];
+        if (symbols)
+            printf("%10zu  %-12s %04X  %-20s %s\n", i, symbols->describe(r.pc).c_str(), r.inst,
+                disassemble(r.pc, r.inst, symbols).c_str(), effect(r).c_str());
+        else
+            printf("%10zu  x%04X  %04X  %-20s %s\n", i, r.pc, r.inst,
+                disassemble(r.pc, r.inst).c_str(), effect(r).c_str());
+    }
+    return 0;
+}
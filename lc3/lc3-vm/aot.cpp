@@ -0,0 +1,14 @@
+#include "aot.h"
+
+#include "vm.h"
+
+uint16_t aot_state::device_read(uint16_t address)
+{
+    return machine->memory_.read(address);
+}
+
+bool aot_state::store(uint16_t address, uint16_t value)
+{
+    machine->store(address, value);
+    return machine->aot_ == nullptr;
+}
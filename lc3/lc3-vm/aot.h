@@ -0,0 +1,93 @@
+#ifndef __aot_h__
+#define __aot_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "decode_cache.h"
+#include "memory.h"
+
+class vm;
+struct aot_image;
+
+// Runtime for images translated to C++ by lc3-aot. A translated image is
+// linked with the vm sources and attached with vm::load(const aot_image &);
+// vm::run() then calls the block functions, and falls back to the
+// interpreter for traps and for jumps to code that was not translated.
+struct aot_state
+{
+    // or'd into the pc returned by a block when the instruction at pc has
+    // to be executed by the interpreter
+    static const uint32_t interpret = 0x10000;
+
+    uint16_t *regs;
+    uint16_t *mem;
+    const uint8_t *device_pages;
+    uint8_t *dirty_pages;
+    uint16_t cc;        // last result, the condition codes are derived from it
+    int64_t budget;     // blocks take their length off before they run
+    const aot_image *image;
+    decode_cache *decoded;
+    vm *machine;
+
+    uint16_t read(uint16_t address)
+    {
+        if (device_pages[address >> memory::page_bits])
+            return device_read(address);
+        return mem[address];
+    }
+
+    // returns true when the write modified translated code, the block has to
+    // return to the vm straight away
+    bool write(uint16_t address, uint16_t value);
+
+    // gives back the budget of the instructions a block skipped by leaving early
+    uint32_t refund(int64_t skipped, uint32_t pc)
+    {
+        budget += skipped;
+        return pc;
+    }
+
+    bool n() const { return (cc & 0x8000) != 0; }
+    bool z() const { return cc == 0; }
+    bool p() const { return cc != 0 && (cc & 0x8000) == 0; }
+
+private:
+    uint16_t device_read(uint16_t address);
+    bool store(uint16_t address, uint16_t value);
+};
+
+typedef uint32_t (*aot_block)(aot_state &state);
+
+struct aot_image
+{
+    uint16_t origin;
+    size_t size;
+    const uint16_t *words;
+    const aot_block *blocks;    // indexed by address - origin, null where no block starts
+    const uint8_t *code;        // indexed by address - origin, set for translated words
+
+    aot_block find(uint16_t address) const
+    {
+        uint16_t index = address - origin;
+        return index < size ? blocks[index] : nullptr;
+    }
+
+    bool translated(uint16_t address) const
+    {
+        uint16_t index = address - origin;
+        return index < size && code[index] != 0;
+    }
+};
+
+inline bool aot_state::write(uint16_t address, uint16_t value)
+{
+    if (device_pages[address >> memory::page_bits] || image->translated(address))
+        return store(address, value);
+    mem[address] = value;
+    dirty_pages[address >> memory::page_bits] = 1;
+    decoded->invalidate(address);
+    return false;
+}
+
+#endif // __aot_h__
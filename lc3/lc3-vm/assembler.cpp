@@ -0,0 +1,588 @@
+#include "assembler.h"
+
+#include "op_codes.h"
+#include "traps.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace
+{
+    enum class form
+    {
+        add_and,        // DR, SR1, SR2 or imm5
+        not_op,         // DR, SR
+        br,             // label or offset9, the word holds the condition
+        pc_offset9,     // DR/SR, label or offset9
+        base_offset6,   // DR/SR, BaseR, offset6
+        jmp,            // BaseR
+        jsr,            // label or offset11
+        jsrr,           // BaseR
+        trap,           // trapvect8
+        fixed,          // no operands: RET, RTI, the trap aliases
+        orig,
+        fill,
+        blkw,
+        stringz,
+        end
+    };
+
+    struct mnemonic
+    {
+        form kind;
+        uint16_t word;
+    };
+
+    uint16_t op(op_codes code)
+    {
+        return static_cast<uint16_t>(static_cast<int>(code) << 12);
+    }
+
+    const std::unordered_map<std::string, mnemonic> &mnemonics()
+    {
+        static const std::unordered_map<std::string, mnemonic> table =
+        {
+            { "ADD", { form::add_and, op(op_codes::op_add) } },
+            { "AND", { form::add_and, op(op_codes::op_and) } },
+            { "NOT", { form::not_op, static_cast<uint16_t>(op(op_codes::op_not) | 0x003F) } },
+            { "BR", { form::br, 0x0E00 } },
+            { "BRN", { form::br, 0x0800 } },
+            { "BRZ", { form::br, 0x0400 } },
+            { "BRP", { form::br, 0x0200 } },
+            { "BRNZ", { form::br, 0x0C00 } },
+            { "BRNP", { form::br, 0x0A00 } },
+            { "BRZP", { form::br, 0x0600 } },
+            { "BRNZP", { form::br, 0x0E00 } },
+            { "LD", { form::pc_offset9, op(op_codes::op_ld) } },
+            { "LDI", { form::pc_offset9, op(op_codes::op_ldi) } },
+            { "LEA", { form::pc_offset9, op(op_codes::op_lea) } },
+            { "ST", { form::pc_offset9, op(op_codes::op_st) } },
+            { "STI", { form::pc_offset9, op(op_codes::op_sti) } },
+            { "LDR", { form::base_offset6, op(op_codes::op_ldr) } },
+            { "STR", { form::base_offset6, op(op_codes::op_str) } },
+            { "JMP", { form::jmp, op(op_codes::op_jmp) } },
+            { "RET", { form::fixed, static_cast<uint16_t>(op(op_codes::op_jmp) | 7 << 6) } },
+            { "JSR", { form::jsr, static_cast<uint16_t>(op(op_codes::op_jsr) | 0x0800) } },
+            { "JSRR", { form::jsrr, op(op_codes::op_jsr) } },
+            { "RTI", { form::fixed, op(op_codes::op_rti) } },
+            { "TRAP", { form::trap, op(op_codes::op_trap) } },
+            { "GETC", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_getc) } },
+            { "OUT", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_out) } },
+            { "PUTS", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_puts) } },
+            { "IN", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_in) } },
+            { "PUTSP", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_putsp) } },
+            { "HALT", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_halt) } },
+            { "MEMCPY", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_memcpy) } },
+            { "MEMSET", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_memset) } },
+            { "STRLEN", { form::fixed, static_cast<uint16_t>(op(op_codes::op_trap) | tr_strlen) } },
+            { ".ORIG", { form::orig, 0 } },
+            { ".FILL", { form::fill, 0 } },
+            { ".BLKW", { form::blkw, 0 } },
+            { ".STRINGZ", { form::stringz, 0 } },
+            { ".END", { form::end, 0 } }
+        };
+        return table;
+    }
+
+    std::string upper(const std::string &s)
+    {
+        std::string u(s);
+        for (auto &c : u)
+        {
+            c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        }
+        return u;
+    }
+
+    struct statement
+    {
+        int line;
+        const mnemonic *what;
+        std::vector<std::string> operands;
+        std::string text;       // the string of .STRINGZ, escapes resolved
+        uint16_t address;
+    };
+
+    // Splits a line into tokens at blanks and commas up to a comment.
+    // A quoted string is one token, text holds it unescaped.
+    bool tokenize(const std::string &line, std::vector<std::string> &tokens, std::string &text, bool &quoted, std::string &error)
+    {
+        tokens.clear();
+        quoted = false;
+        size_t i = 0;
+        while (i < line.size())
+        {
+            char c = line[i];
+            if (c == ';')
+                break;
+            if (isspace(static_cast<unsigned char>(c)) || c == ',')
+            {
+                ++i;
+                continue;
+            }
+            if (c == '"')
+            {
+                text.clear();
+                for (++i; i < line.size() && line[i] != '"'; ++i)
+                {
+                    c = line[i];
+                    if (c == '\\' && i + 1 < line.size())
+                    {
+                        switch (line[++i])
+                        {
+                        case 'n': c = '\n'; break;
+                        case 't': c = '\t'; break;
+                        case 'r': c = '\r'; break;
+                        case '0': c = '\0'; break;
+                        default: c = line[i]; break;
+                        }
+                    }
+                    text += c;
+                }
+                if (i == line.size())
+                {
+                    error = "unterminated string";
+                    return false;
+                }
+                ++i;
+                quoted = true;
+                tokens.push_back("\"");
+                continue;
+            }
+            auto start = i;
+            while (i < line.size() && !isspace(static_cast<unsigned char>(line[i])) && line[i] != ',' && line[i] != ';' && line[i] != '"')
+            {
+                ++i;
+            }
+            tokens.push_back(line.substr(start, i - start));
+        }
+        return true;
+    }
+
+    bool digits(const std::string &s, size_t from, int base)
+    {
+        if (from >= s.size())
+            return false;
+        for (size_t i = from; i < s.size(); ++i)
+        {
+            int c = toupper(static_cast<unsigned char>(s[i]));
+            int d = isdigit(c) ? c - '0' : (c >= 'A' && c <= 'F' ? c - 'A' + 10 : 99);
+            if (d >= base)
+                return false;
+        }
+        return true;
+    }
+
+    // #-12, x3000, 0x3000, b0101 and plain decimals
+    bool number(const std::string &s, long &value)
+    {
+        if (s.empty())
+            return false;
+        size_t at = 0;
+        int base = 10;
+        auto c = toupper(static_cast<unsigned char>(s[0]));
+        if (c == '#')
+        {
+            at = 1;
+        }
+        else if (c == 'X')
+        {
+            at = 1;
+            base = 16;
+        }
+        else if (c == 'B')
+        {
+            at = 1;
+            base = 2;
+        }
+        else if (c == '0' && s.size() > 2 && toupper(static_cast<unsigned char>(s[1])) == 'X')
+        {
+            at = 2;
+            base = 16;
+        }
+        bool negative = at < s.size() && s[at] == '-';
+        if (negative)
+            ++at;
+        if (!digits(s, at, base))
+            return false;
+        value = strtol(s.c_str() + at, nullptr, base);
+        if (negative)
+            value = -value;
+        return true;
+    }
+
+    bool reg(const std::string &s, uint16_t &r)
+    {
+        if (s.size() != 2 || toupper(static_cast<unsigned char>(s[0])) != 'R' || s[1] < '0' || s[1] > '7')
+            return false;
+        r = static_cast<uint16_t>(s[1] - '0');
+        return true;
+    }
+
+    class encoder
+    {
+    public:
+        encoder(assembly &program, const statement &s)
+            : program_(program), s_(s)
+        {
+        }
+
+        void error(const std::string &message)
+        {
+            program_.errors.push_back({ s_.line, message });
+        }
+
+        bool count(size_t n)
+        {
+            if (s_.operands.size() == n)
+                return true;
+            error("expects " + std::to_string(n) + (n == 1 ? " operand" : " operands"));
+            return false;
+        }
+
+        uint16_t reg_at(size_t i)
+        {
+            uint16_t r = 0;
+            if (!reg(s_.operands[i], r))
+                error("not a register: " + s_.operands[i]);
+            return r;
+        }
+
+        // a number taken as is, or a label's address
+        long value_at(size_t i)
+        {
+            long v = 0;
+            uint16_t address;
+            if (number(s_.operands[i], v))
+                return v;
+            if (program_.symbols.find(s_.operands[i], address))
+                return address;
+            error("undefined label " + s_.operands[i]);
+            return 0;
+        }
+
+        // a 16 bit word, as .FILL takes it
+        uint16_t word_at(size_t i)
+        {
+            long v = value_at(i);
+            if (v < -32768 || v > 0xFFFF)
+                error(std::to_string(v) + " does not fit in 16 bits");
+            return static_cast<uint16_t>(v);
+        }
+
+        uint16_t immediate(size_t i, int bits, bool is_signed = true)
+        {
+            long v = 0;
+            if (!number(s_.operands[i], v))
+            {
+                error("not a number: " + s_.operands[i]);
+                return 0;
+            }
+            return fit(v, bits, is_signed);
+        }
+
+        // a label is relative to the next instruction, a number is the offset
+        uint16_t offset(size_t i, int bits)
+        {
+            long v = 0;
+            uint16_t address;
+            if (!number(s_.operands[i], v))
+            {
+                if (!program_.symbols.find(s_.operands[i], address))
+                {
+                    error("undefined label " + s_.operands[i]);
+                    return 0;
+                }
+                v = static_cast<long>(address) - (s_.address + 1);
+            }
+            return fit(v, bits, true);
+        }
+
+        uint16_t fit(long v, int bits, bool is_signed)
+        {
+            long low = is_signed ? -(1L << (bits - 1)) : 0;
+            long high = is_signed ? (1L << (bits - 1)) - 1 : (1L << bits) - 1;
+            if (v < low || v > high)
+            {
+                error(std::to_string(v) + " does not fit in " + std::to_string(bits) + " bits");
+                return 0;
+            }
+            return static_cast<uint16_t>(v & ((1 << bits) - 1));
+        }
+
+    private:
+        assembly &program_;
+        const statement &s_;
+    };
+
+    void encode(assembly &program, const statement &s, std::vector<uint16_t> &words)
+    {
+        encoder e(program, s);
+        uint16_t w = s.what->word;
+        switch (s.what->kind)
+        {
+        case form::add_and:
+            if (!e.count(3))
+                return;
+            w |= e.reg_at(0) << 9 | e.reg_at(1) << 6;
+            uint16_t r;
+            if (reg(s.operands[2], r))
+                w |= r;
+            else
+                w |= 0x20 | e.immediate(2, 5);
+            break;
+        case form::not_op:
+            if (!e.count(2))
+                return;
+            w |= e.reg_at(0) << 9 | e.reg_at(1) << 6;
+            break;
+        case form::br:
+        case form::jsr:
+            if (!e.count(1))
+                return;
+            w |= e.offset(0, s.what->kind == form::br ? 9 : 11);
+            break;
+        case form::pc_offset9:
+            if (!e.count(2))
+                return;
+            w |= e.reg_at(0) << 9 | e.offset(1, 9);
+            break;
+        case form::base_offset6:
+            if (!e.count(3))
+                return;
+            w |= e.reg_at(0) << 9 | e.reg_at(1) << 6 | e.immediate(2, 6);
+            break;
+        case form::jmp:
+        case form::jsrr:
+            if (!e.count(1))
+                return;
+            w |= e.reg_at(0) << 6;
+            break;
+        case form::trap:
+            if (!e.count(1))
+                return;
+            w |= e.immediate(0, 8, false);
+            break;
+        case form::fixed:
+            e.count(0);
+            break;
+        case form::fill:
+            if (!e.count(1))
+                return;
+            w = e.word_at(0);
+            break;
+        case form::blkw:
+            {
+                // the count was checked by the first pass
+                long n = 0;
+                number(s.operands[0], n);
+                words.insert(words.end(), static_cast<size_t>(n), s.operands.size() == 2 ? e.word_at(1) : 0);
+            }
+            return;
+        case form::stringz:
+            for (auto c : s.text)
+            {
+                words.push_back(static_cast<uint8_t>(c));
+            }
+            words.push_back(0);
+            return;
+        case form::orig:
+        case form::end:
+            return;
+        }
+        words.push_back(w);
+    }
+}
+
+bool symbol_table::add(const std::string &name, uint16_t address)
+{
+    if (!by_name_.emplace(upper(name), address).second)
+        return false;
+    by_address_.emplace(address, name);
+    return true;
+}
+
+bool symbol_table::find(const std::string &name, uint16_t &address) const
+{
+    auto found = by_name_.find(upper(name));
+    if (found == by_name_.end())
+        return false;
+    address = found->second;
+    return true;
+}
+
+const std::string *symbol_table::name(uint16_t address) const
+{
+    auto found = by_address_.find(address);
+    return found == by_address_.end() ? nullptr : &found->second;
+}
+
+std::string symbol_table::describe(uint16_t address) const
+{
+    auto after = by_address_.upper_bound(address);
+    if (after == by_address_.begin())
+    {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "x%04X", address);
+        return buf;
+    }
+    --after;
+    if (after->first == address)
+        return after->second;
+    return after->second + "+" + std::to_string(address - after->first);
+}
+
+bool symbol_table::empty() const
+{
+    return by_name_.empty();
+}
+
+void symbol_table::clear()
+{
+    by_name_.clear();
+    by_address_.clear();
+}
+
+uint16_t assembly::entry() const
+{
+    return segments.empty() ? 0x3000 : segments.front().origin;
+}
+
+bool assemble(const std::string &source, assembly &program)
+{
+    program.segments.clear();
+    program.symbols.clear();
+    program.errors.clear();
+
+    // first pass: addresses of every statement and label
+    auto &table = mnemonics();
+    std::vector<statement> statements;
+    std::vector<std::string> tokens;
+    std::string text;
+    bool quoted;
+    bool in_block = false;
+    uint32_t pc = 0;
+    int number_of_line = 0;
+    size_t at = 0;
+    while (at <= source.size())
+    {
+        auto eol = source.find('\n', at);
+        if (eol == std::string::npos)
+            eol = source.size();
+        std::string line = source.substr(at, eol - at);
+        at = eol + 1;
+        ++number_of_line;
+
+        std::string error;
+        if (!tokenize(line, tokens, text, quoted, error))
+        {
+            program.errors.push_back({ number_of_line, error });
+            continue;
+        }
+        if (tokens.empty())
+            continue;
+
+        auto known = table.find(upper(tokens[0]));
+        if (known == table.end())
+        {
+            auto label = tokens[0];
+            if (label.size() > 1 && label.back() == ':')
+                label.pop_back();
+            long ignored;
+            if (!in_block)
+                program.errors.push_back({ number_of_line, "label " + label + " outside .ORIG/.END" });
+            else if (number(label, ignored) || (!isalpha(static_cast<unsigned char>(label[0])) && label[0] != '_'))
+                program.errors.push_back({ number_of_line, "not an opcode or label: " + label });
+            else if (!program.symbols.add(label, static_cast<uint16_t>(pc)))
+                program.errors.push_back({ number_of_line, "label " + label + " defined twice" });
+            tokens.erase(tokens.begin());
+            if (tokens.empty())
+                continue;
+            known = table.find(upper(tokens[0]));
+            if (known == table.end())
+            {
+                // "FOO R1" took the mnemonic for a label
+                uint16_t r;
+                program.errors.push_back({ number_of_line, "unknown opcode " + (reg(tokens[0], r) ? label : tokens[0]) });
+                continue;
+            }
+        }
+
+        statement s = { number_of_line, &known->second, std::vector<std::string>(tokens.begin() + 1, tokens.end()), "", static_cast<uint16_t>(pc) };
+        auto kind = s.what->kind;
+        if (kind == form::orig)
+        {
+            long origin = 0;
+            if (in_block)
+                program.errors.push_back({ number_of_line, ".ORIG before the .END of the last block" });
+            else if (s.operands.size() != 1 || !number(s.operands[0], origin) || origin < 0 || origin > 0xFFFF)
+                program.errors.push_back({ number_of_line, ".ORIG expects an address" });
+            else
+            {
+                in_block = true;
+                pc = static_cast<uint32_t>(origin);
+                s.address = static_cast<uint16_t>(origin);
+                statements.push_back(s);
+            }
+            continue;
+        }
+        if (!in_block)
+        {
+            program.errors.push_back({ number_of_line, tokens[0] + " outside .ORIG/.END" });
+            continue;
+        }
+        if (kind == form::end)
+        {
+            in_block = false;
+            continue;
+        }
+
+        uint32_t size = 1;
+        if (kind == form::blkw)
+        {
+            long n = 0;
+            if (s.operands.empty() || s.operands.size() > 2 || !number(s.operands[0], n) || n < 0)
+            {
+                program.errors.push_back({ number_of_line, ".BLKW expects a count and an optional fill" });
+                continue;
+            }
+            size = static_cast<uint32_t>(n);
+        }
+        else if (kind == form::stringz)
+        {
+            if (!quoted || s.operands.size() != 1)
+            {
+                program.errors.push_back({ number_of_line, ".STRINGZ expects a string" });
+                continue;
+            }
+            s.text = text;
+            size = static_cast<uint32_t>(text.size()) + 1;
+        }
+        if (pc + size > 0x10000)
+        {
+            program.errors.push_back({ number_of_line, "past the end of memory" });
+            continue;
+        }
+        pc += size;
+        statements.push_back(std::move(s));
+    }
+    if (in_block)
+        program.errors.push_back({ number_of_line, "no .END" });
+
+    // second pass: every label is known, encode
+    for (auto &s : statements)
+    {
+        if (s.what->kind == form::orig)
+        {
+            program.segments.push_back({ s.address, {} });
+            continue;
+        }
+        encode(program, s, program.segments.back().words);
+    }
+
+    std::stable_sort(program.errors.begin(), program.errors.end(),
+        [](const assembly_error &a, const assembly_error &b) { return a.line < b.line; });
+    return program.errors.empty();
+}
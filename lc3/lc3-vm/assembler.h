@@ -0,0 +1,57 @@
+#ifndef __assembler_h__
+#define __assembler_h__
+
+#include "object.h"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Labels of a program. Names match without regard to case, as opcodes do,
+// and keep the spelling they were defined with.
+class symbol_table
+{
+public:
+    // false if name is taken
+    bool add(const std::string &name, uint16_t address);
+    bool find(const std::string &name, uint16_t &address) const;
+    // the label defined at address, nullptr if there is none
+    const std::string *name(uint16_t address) const;
+    // "LOOP", "LOOP+3" past the closest label before it, or "x3005"
+    std::string describe(uint16_t address) const;
+    bool empty() const;
+    void clear();
+
+private:
+    std::unordered_map<std::string, uint16_t> by_name_;     // upper case
+    std::map<uint16_t, std::string> by_address_;
+};
+
+struct assembly_error
+{
+    int line;
+    std::string message;
+};
+
+// An assembled program: a segment for every .ORIG block, the first one is
+// where it starts.
+struct assembly
+{
+    std::vector<object_image> segments;
+    symbol_table symbols;
+    std::vector<assembly_error> errors;
+
+    uint16_t entry() const;
+};
+
+// Two pass LC-3 assembler: every opcode, the BR variants, RET, JSRR, the
+// trap aliases (GETC, OUT, PUTS, IN, PUTSP, HALT and the bulk MEMCPY,
+// MEMSET, STRLEN), labels, .ORIG, .FILL, .BLKW count [fill], .STRINGZ and
+// .END. The reserved opcode has no mnemonic, it takes a .FILL. Numbers are
+// #decimal, xhex, bbinary or plain decimal. Returns false with the errors of
+// every line in program.errors; vm::load() takes the result.
+bool assemble(const std::string &source, assembly &program);
+
+#endif // __assembler_h__
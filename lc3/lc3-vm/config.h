@@ -0,0 +1,25 @@
+#ifndef __config_h__
+#define __config_h__
+
+// Dispatch engine for vm::run(). GCC and Clang get direct-threaded dispatch
+// (labels as values) unless LC3_SWITCH_DISPATCH is defined; everything else
+// uses the portable switch.
+#if !defined(LC3_SWITCH_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define LC3_THREADED_DISPATCH
+#endif
+
+// Basic block compiler to x86-64, see jit.h. Define LC3_NO_JIT to leave it out.
+#if !defined(LC3_NO_JIT) && (defined(__x86_64__) || defined(_M_X64))
+#define LC3_JIT
+#endif
+
+// Vector kernels for swapping big endian object words, see swap_words().
+// Picked at compile time; AVX2 needs /arch:AVX2 or -mavx2.
+#if defined(__AVX2__)
+#define LC3_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LC3_SSE2
+#endif
+
+#endif // __config_h__
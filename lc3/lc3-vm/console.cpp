@@ -0,0 +1,106 @@
+#include "console.h"
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <conio.h>
+
+void console_raw_mode(bool raw)
+{
+    HANDLE csl = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD mode = { 0 };
+    GetConsoleMode(csl, &mode);
+    if (raw)
+        mode = mode & ~ENABLE_ECHO_INPUT & ~ENABLE_LINE_INPUT;
+    else
+        mode = mode | ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT;
+    SetConsoleMode(csl, mode);
+}
+
+key_result console_key(int timeout_ms, uint16_t &key)
+{
+    HANDLE csl = GetStdHandle(STD_INPUT_HANDLE);
+    if (WaitForSingleObject(csl, timeout_ms) != WAIT_OBJECT_0 || !_kbhit())
+    {
+        return key_result::timeout;
+    }
+    key = static_cast<uint16_t>(_getch());
+    return key_result::key;
+}
+
+void console_write(const char *data, size_t size)
+{
+    HANDLE csl = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD written = 0;
+    WriteFile(csl, data, static_cast<DWORD>(size), &written, NULL);
+}
+
+#else
+
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace
+{
+    termios saved_mode;
+    bool saved = false;
+}
+
+void console_raw_mode(bool raw)
+{
+    if (!isatty(STDIN_FILENO))
+    {
+        return;
+    }
+    if (raw)
+    {
+        if (!saved)
+        {
+            tcgetattr(STDIN_FILENO, &saved_mode);
+            saved = true;
+        }
+        termios mode = saved_mode;
+        mode.c_lflag &= ~(ICANON | ECHO);
+        mode.c_cc[VMIN] = 1;
+        mode.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &mode);
+    }
+    else if (saved)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_mode);
+    }
+}
+
+key_result console_key(int timeout_ms, uint16_t &key)
+{
+    pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    if (poll(&fd, 1, timeout_ms) <= 0)
+    {
+        return key_result::timeout;
+    }
+    unsigned char c;
+    if (read(STDIN_FILENO, &c, 1) != 1)
+    {
+        return key_result::closed;
+    }
+    key = c;
+    return key_result::key;
+}
+
+void console_write(const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        auto written = write(STDOUT_FILENO, data, size);
+        if (written <= 0)
+        {
+            return;
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __console_h__
+#define __console_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Platform console backends, Windows console API or POSIX termios.
+enum class key_result
+{
+    key,
+    timeout,
+    closed
+};
+
+void console_raw_mode(bool raw);
+key_result console_key(int timeout_ms, uint16_t &key);
+void console_write(const char *data, size_t size);
+
+#endif // __console_h__
@@ -0,0 +1,65 @@
+#include "debug.h"
+
+#include <algorithm>
+
+watch_list::watch_list(interrupt_controller &interrupts)
+    : interrupts_(interrupts)
+{
+}
+
+void watch_list::add(uint16_t first, uint16_t last, watch_kind kind)
+{
+    ranges_.push_back({ first, last, kind });
+}
+
+void watch_list::remove(uint16_t first, uint16_t last)
+{
+    ranges_.erase(std::remove_if(ranges_.begin(), ranges_.end(),
+        [=](const range &r) { return r.first == first && r.last == last; }), ranges_.end());
+}
+
+void watch_list::clear()
+{
+    ranges_.clear();
+}
+
+bool watch_list::empty() const
+{
+    return ranges_.empty();
+}
+
+void watch_list::watch_pages(memory &ram) const
+{
+    ram.unwatch();
+    for (auto &r : ranges_)
+    {
+        ram.watch(r.first, r.last);
+    }
+}
+
+bool watch_list::take(watch_hit &hit)
+{
+    if (!hit_pending_)
+        return false;
+    hit = hit_;
+    hit_pending_ = false;
+    return true;
+}
+
+// the first hit of an instruction is the one reported
+void watch_list::accessed(uint16_t address, bool write)
+{
+    if (hit_pending_)
+        return;
+    auto wanted = write ? watch_kind::write : watch_kind::read;
+    for (auto &r : ranges_)
+    {
+        if (address >= r.first && address <= r.last && (static_cast<int>(r.kind) & static_cast<int>(wanted)))
+        {
+            hit_ = { address, write };
+            hit_pending_ = true;
+            interrupts_.request_stop();
+            return;
+        }
+    }
+}
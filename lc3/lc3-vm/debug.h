@@ -0,0 +1,57 @@
+#ifndef __debug_h__
+#define __debug_h__
+
+#include "interrupts.h"
+#include "memory.h"
+
+#include <stdint.h>
+#include <vector>
+
+enum class watch_kind
+{
+    read = 1,
+    write = 2,
+    access = 3
+};
+
+// The access that stopped a vm with exit_reason::watchpoint.
+struct watch_hit
+{
+    uint16_t address;
+    bool write;
+};
+
+// Watchpoints of one vm. memory only sends accesses to watched pages here;
+// one that matches a range asks the vm to stop once the instruction is done.
+class watch_list : public watcher
+{
+public:
+    explicit watch_list(interrupt_controller &interrupts);
+
+    // watch_pages() brings memory up to date after a change
+    void add(uint16_t first, uint16_t last, watch_kind kind);
+    void remove(uint16_t first, uint16_t last);
+    void clear();
+    bool empty() const;
+    void watch_pages(memory &ram) const;
+
+    // the access that hit last, false if none since the last call
+    bool take(watch_hit &hit);
+
+    void accessed(uint16_t address, bool write) override;
+
+private:
+    struct range
+    {
+        uint16_t first;
+        uint16_t last;
+        watch_kind kind;
+    };
+
+    interrupt_controller &interrupts_;
+    std::vector<range> ranges_;
+    watch_hit hit_ = { 0, false };
+    bool hit_pending_ = false;
+};
+
+#endif // __debug_h__
@@ -0,0 +1,367 @@
+#include "decode_cache.h"
+
+#include "memory.h"
+#include "utility.h"
+
+#include <algorithm>
+
+namespace
+{
+    const char *fusion_names_[] =
+    {
+        "none", "clear_add", "negate", "add_br", "and_br", "ld_br", "ldr_br",
+        "ldr_add", "add_add", "add_add_br", "ldr_add_str", "ld_add_st"
+    };
+
+    // Decodes word index of a page and marks the longest enabled sequence
+    // that starts there; sequences end with the page. marked(i) says whether
+    // word i holds a breakpoint.
+    template <typename Marked>
+    decoded decode_fused(const uint16_t *words, size_t index, const fusion_set &enabled, Marked marked)
+    {
+        decoded run[3];
+        size_t n = std::min<size_t>(3, decode_cache::page_size - index);
+        for (size_t i = 0; i < n; ++i)
+        {
+            run[i] = decode(words[index + i]);
+            if (marked(index + i))
+            {
+                run[i].op = op_codes::op_break;
+                run[i].handler = static_cast<uint8_t>(op_codes::op_break);
+            }
+        }
+        if (run[0].op == op_codes::op_break || enabled.none())
+            return run[0];
+        // the triples come last
+        for (auto f = static_cast<int>(fusion::count) - 1; f > 0; --f)
+        {
+            auto kind = static_cast<fusion>(f);
+            if (enabled.test(f) && fusion_length(kind) <= n && fuses(kind, run))
+            {
+                run[0].handler = fused_handler(kind);
+                break;
+            }
+        }
+        return run[0];
+    }
+}
+
+decoded decode(uint16_t inst)
+{
+    decoded d = {};
+    d.op = static_cast<op_codes>(inst >> 12);
+    d.dr = (inst >> 9) & 0x7;
+    d.sr1 = (inst >> 6) & 0x7;
+    d.sr2 = inst & 0x7;
+    d.inst = inst;
+    d.valid = true;
+    d.handler = static_cast<uint8_t>(d.op);
+
+    switch (d.op)
+    {
+    case op_codes::op_add:
+    case op_codes::op_and:
+        d.mode = (inst >> 5) & 0x1;
+        d.imm = sign_extend(inst & 0x1F, 5);
+        break;
+    case op_codes::op_br:
+    case op_codes::op_ld:
+    case op_codes::op_ldi:
+    case op_codes::op_lea:
+    case op_codes::op_st:
+    case op_codes::op_sti:
+        d.imm = sign_extend(inst & 0x1FF, 9);
+        break;
+    case op_codes::op_ldr:
+    case op_codes::op_str:
+        d.imm = sign_extend(inst & 0x3F, 6);
+        break;
+    case op_codes::op_jsr:
+        d.mode = (inst >> 11) & 0x1;
+        d.imm = sign_extend(inst & 0x7FF, 11);
+        break;
+    case op_codes::op_trap:
+        d.imm = inst & 0xFF;
+        break;
+    default:
+        break;
+    }
+    return d;
+}
+
+fusion_set all_fusions()
+{
+    fusion_set all;
+    all.set();
+    all.reset(static_cast<size_t>(fusion::none));
+    return all;
+}
+
+const char *fusion_name(fusion f)
+{
+    return fusion_names_[static_cast<int>(f)];
+}
+
+size_t fusion_length(fusion f)
+{
+    switch (f)
+    {
+    case fusion::none:
+        return 1;
+    case fusion::add_add_br:
+    case fusion::ldr_add_str:
+    case fusion::ld_add_st:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+bool parse_fusions(const std::string &names, fusion_set &set)
+{
+    set.reset();
+    if (names == "none")
+        return true;
+    if (names == "all")
+    {
+        set = all_fusions();
+        return true;
+    }
+    size_t start = 0;
+    while (start <= names.size())
+    {
+        auto end = std::min(names.find(',', start), names.size());
+        auto name = names.substr(start, end - start);
+        auto found = std::find_if(std::begin(fusion_names_) + 1, std::end(fusion_names_),
+            [&name](const char *n) { return name == n; });
+        if (found == std::end(fusion_names_))
+            return false;
+        set.set(found - std::begin(fusion_names_));
+        start = end + 1;
+    }
+    return true;
+}
+
+std::string fusion_names(const fusion_set &set)
+{
+    std::string names;
+    for (size_t f = 1; f < set.size(); ++f)
+    {
+        if (set.test(f))
+            names += (names.empty() ? "" : ",") + std::string(fusion_names_[f]);
+    }
+    return names.empty() ? "none" : names;
+}
+
+bool fuses(fusion f, const decoded *first)
+{
+    auto &a = first[0];
+    auto &b = first[1];
+    switch (f)
+    {
+    case fusion::clear_add:
+        return a.op == op_codes::op_and && a.mode && a.imm == 0 &&
+            b.op == op_codes::op_add && b.mode && b.dr == a.dr && b.sr1 == a.dr;
+    case fusion::negate:
+        return a.op == op_codes::op_not &&
+            b.op == op_codes::op_add && b.mode && b.imm == 1 && b.dr == a.dr && b.sr1 == a.dr;
+    case fusion::add_br:
+        return a.op == op_codes::op_add && b.op == op_codes::op_br;
+    case fusion::and_br:
+        return a.op == op_codes::op_and && b.op == op_codes::op_br;
+    case fusion::ld_br:
+        return a.op == op_codes::op_ld && b.op == op_codes::op_br;
+    case fusion::ldr_br:
+        return a.op == op_codes::op_ldr && b.op == op_codes::op_br;
+    case fusion::ldr_add:
+        return a.op == op_codes::op_ldr && b.op == op_codes::op_add;
+    case fusion::add_add:
+        return a.op == op_codes::op_add && b.op == op_codes::op_add;
+    case fusion::add_add_br:
+        return a.op == op_codes::op_add && b.op == op_codes::op_add && first[2].op == op_codes::op_br;
+    case fusion::ldr_add_str:
+        return a.op == op_codes::op_ldr && b.op == op_codes::op_add && first[2].op == op_codes::op_str;
+    case fusion::ld_add_st:
+        return a.op == op_codes::op_ld && b.op == op_codes::op_add && first[2].op == op_codes::op_st;
+    default:
+        return false;
+    }
+}
+
+std::shared_ptr<const decoded_image> predecode(const memory_image &image, const fusion_set &fusions)
+{
+    static_assert(memory::page_bits == decode_cache::page_bits, "decoded pages line up with memory pages");
+    auto decoded = std::make_shared<decoded_image>();
+    decoded->fusions = fusions;
+    for (size_t i = 0; i < decode_cache::page_count; ++i)
+    {
+        auto &words = image.pages[i];
+        if (!words)
+            continue;
+        auto p = std::make_shared<decode_cache::page>();
+        for (size_t w = 0; w < decode_cache::page_size; ++w)
+        {
+            (*p)[w] = decode_fused(words->data(), w, fusions, [](size_t) { return false; });
+        }
+        decoded->pages[i] = p;
+    }
+    return decoded;
+}
+
+decoded unmarked(const decoded &d)
+{
+    auto real = d;
+    real.op = static_cast<op_codes>(d.inst >> 12);
+    real.handler = static_cast<uint8_t>(real.op);
+    return real;
+}
+
+const decoded &decode_cache::fetch(memory &mem, uint16_t address)
+{
+    auto p = pages_[address >> page_bits];
+    if (p == nullptr)
+    {
+        p = own(address >> page_bits);
+    }
+    // every word of a shared page is valid, so those are never written
+    auto index = address & (page_size - 1);
+    auto &d = (*p)[index];
+    if (!d.valid)
+    {
+        // the interpreter reads a fused sequence straight from the page, so
+        // the rest of it has to be decoded too
+        for (size_t i = index, last = index; i <= last; ++i)
+        {
+            if (!(*p)[i].valid)
+            {
+                decode_at(mem, *p, static_cast<uint16_t>(address - index + i));
+                last = std::max(last, i + fusion_length(fused((*p)[i])) - 1);
+            }
+        }
+    }
+    return d;
+}
+
+void decode_cache::decode_at(memory &mem, page &p, uint16_t address)
+{
+    // instructions come from RAM, fetching one reads no device and trips no
+    // watchpoint
+    auto first = static_cast<uint16_t>(address & ~(page_size - 1));
+    p[address - first] = decode_fused(mem.get() + first, address - first, fusions_,
+        [this, first](size_t i) { return breakpoints_.test(first + i); });
+}
+
+void decode_cache::invalidate(uint16_t address)
+{
+    auto index = address >> page_bits;
+    if (shared_[index])
+    {
+        own(index);
+    }
+    auto p = pages_[index];
+    if (p)
+    {
+        // and the sequences it is part of
+        auto word = address & (page_size - 1);
+        for (auto i = word >= 2 ? word - 2 : 0; i <= word; ++i)
+        {
+            (*p)[i].valid = false;
+        }
+    }
+}
+
+void decode_cache::invalidate_page(size_t page)
+{
+    if (shared_[page])
+    {
+        shared_[page].reset();
+        pages_[page] = owned_[page].get();
+    }
+    auto p = pages_[page];
+    if (p)
+    {
+        for (auto &d : *p)
+        {
+            d.valid = false;
+        }
+    }
+}
+
+void decode_cache::clear()
+{
+    for (size_t i = 0; i < page_count; ++i)
+    {
+        pages_[i] = nullptr;
+        owned_[i].reset();
+        shared_[i].reset();
+    }
+}
+
+void decode_cache::adopt(const decoded_image &image)
+{
+    for (size_t i = 0; i < page_count; ++i)
+    {
+        auto &from = image.pages[i];
+        if (!from || from == shared_[i] || image.fusions != fusions_)
+            continue;
+        if (breakpoint_count_ != 0)
+        {
+            auto first = i << page_bits;
+            bool marked = false;
+            for (size_t a = first; a < first + page_size && !marked; ++a)
+            {
+                marked = breakpoints_.test(a);
+            }
+            if (marked)
+                continue;
+        }
+        shared_[i] = from;
+        pages_[i] = const_cast<page *>(from.get());
+    }
+}
+
+void decode_cache::set_fusions(const fusion_set &enabled)
+{
+    fusions_ = enabled;
+    clear();
+}
+
+const fusion_set &decode_cache::fusions() const
+{
+    return fusions_;
+}
+
+decode_cache::page *decode_cache::own(size_t index)
+{
+    auto &p = owned_[index];
+    if (!p)
+    {
+        p.reset(new page());
+    }
+    if (shared_[index])
+    {
+        *p = *shared_[index];
+        shared_[index].reset();
+    }
+    pages_[index] = p.get();
+    return p.get();
+}
+
+void decode_cache::set_breakpoint(uint16_t address, bool armed)
+{
+    if (breakpoints_.test(address) == armed)
+        return;
+    breakpoints_.set(address, armed);
+    breakpoint_count_ += armed ? 1 : -1;
+    invalidate(address);
+}
+
+bool decode_cache::breakpoint(uint16_t address) const
+{
+    return breakpoints_.test(address);
+}
+
+bool decode_cache::any_breakpoints() const
+{
+    return breakpoint_count_ != 0;
+}
@@ -0,0 +1,128 @@
+#ifndef __decode_cache_h__
+#define __decode_cache_h__
+
+#include "op_codes.h"
+
+#include <stdint.h>
+#include <array>
+#include <bitset>
+#include <memory>
+#include <string>
+
+class memory;
+struct memory_image;
+struct decoded_image;
+
+// Sequences the interpreter runs as one handler when it finds them in a
+// row: no dispatch, budget or interrupt check between their instructions.
+// A jump into the middle of one runs the rest one by one.
+enum class fusion : uint8_t
+{
+    none,
+    clear_add,      // AND Rd,Rs,#0  ADD Rd,Rd,#n
+    negate,         // NOT Rd,Rs     ADD Rd,Rd,#1
+    add_br,         // ADD  BR
+    and_br,         // AND  BR
+    ld_br,          // LD   BR
+    ldr_br,         // LDR  BR
+    ldr_add,        // LDR  ADD
+    add_add,        // ADD  ADD
+    add_add_br,     // ADD  ADD  BR
+    ldr_add_str,    // LDR  ADD  STR
+    ld_add_st,      // LD   ADD  ST
+    count
+};
+
+typedef std::bitset<static_cast<size_t>(fusion::count)> fusion_set;
+
+// every fusion but none
+fusion_set all_fusions();
+const char *fusion_name(fusion f);
+size_t fusion_length(fusion f);
+// "add_br,ldr_add_str", "all" or "none"
+bool parse_fusions(const std::string &names, fusion_set &set);
+std::string fusion_names(const fusion_set &set);
+
+struct decoded
+{
+    op_codes op;
+    uint8_t dr;     // destination / source register for st*, condition mask for br
+    uint8_t sr1;    // first source or base register
+    uint8_t sr2;    // second source register
+    uint8_t mode;   // immediate form for add/and, pc-relative form for jsr
+    uint16_t imm;   // sign extended immediate / offset, trap vector for trap
+    uint16_t inst;
+    bool valid;
+    uint8_t handler;    // what the interpreter dispatches on, op or fused_handler()
+};
+
+inline uint8_t fused_handler(fusion f)
+{
+    return static_cast<uint8_t>(static_cast<int>(op_codes::op_break) + static_cast<int>(f));
+}
+
+// the sequence d starts, if the cache fused one there
+inline fusion fused(const decoded &d)
+{
+    return d.handler > static_cast<int>(op_codes::op_break) ?
+        static_cast<fusion>(d.handler - static_cast<int>(op_codes::op_break)) : fusion::none;
+}
+
+decoded decode(uint16_t inst);
+// the instruction an op_break stands for
+decoded unmarked(const decoded &d);
+// whether the instructions from first on are the sequence f, first holds
+// fusion_length(f) of them
+bool fuses(fusion f, const decoded *first);
+
+class decode_cache
+{
+public:
+    static const uint16_t page_bits = 8;
+    static const uint16_t page_size = 1 << page_bits;
+    static const size_t page_count = 0x10000 >> page_bits;
+    using page = std::array<decoded, page_size>;
+
+    const decoded &fetch(memory &mem, uint16_t address);
+    void invalidate(uint16_t address);
+    void invalidate_page(size_t page);
+    void clear();
+    // reads the pages of image until one of them is invalidated, which
+    // takes a private copy; pages with a breakpoint, or an image fused with
+    // other sequences, are left alone
+    void adopt(const decoded_image &image);
+    // sequences to mark, see fusion; drops everything decoded so far
+    void set_fusions(const fusion_set &enabled);
+    const fusion_set &fusions() const;
+
+    // fetch() returns op_break for an address with a breakpoint, so the
+    // interpreter only looks for breakpoints when it decodes
+    void set_breakpoint(uint16_t address, bool armed);
+    bool breakpoint(uint16_t address) const;
+    bool any_breakpoints() const;
+
+private:
+    page *own(size_t index);
+    void decode_at(memory &mem, page &p, uint16_t address);
+
+private:
+    std::array<page *, page_count> pages_ = {};     // what fetch() reads
+    std::array<std::unique_ptr<page>, page_count> owned_;
+    std::array<std::shared_ptr<const page>, page_count> shared_;
+    std::bitset<0x10000> breakpoints_;
+    size_t breakpoint_count_ = 0;
+    fusion_set fusions_ = all_fusions();
+};
+
+// Every word of a memory image decoded, for vms that all run the same
+// program to share read only; see vm_snapshot::decoded.
+struct decoded_image
+{
+    std::array<std::shared_ptr<const decode_cache::page>, decode_cache::page_count> pages;
+    fusion_set fusions;
+};
+
+// decodes the pages image holds, all zero pages are left out
+std::shared_ptr<const decoded_image> predecode(const memory_image &image, const fusion_set &fusions = all_fusions());
+
+#endif // __decode_cache_h__
@@ -0,0 +1,96 @@
+#include "disasm.h"
+
+#include "assembler.h"
+#include "decode_cache.h"
+
+#include <stdio.h>
+
+namespace
+{
+    const char *const names[] =
+    {
+        "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+        "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+    };
+
+    const char *const traps[] =
+    {
+        "GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT"
+    };
+
+    const char *const bulk_traps[] =
+    {
+        "MEMCPY", "MEMSET", "STRLEN"
+    };
+}
+
+const char *op_name(op_codes op)
+{
+    return names[static_cast<int>(op)];
+}
+
+std::string disassemble(uint16_t pc, uint16_t inst, const symbol_table *symbols)
+{
+    auto d = decode(inst);
+    uint16_t address = pc + 1 + d.imm;
+    char target[8];
+    snprintf(target, sizeof(target), "x%04X", address);
+    auto label = symbols ? symbols->name(address) : nullptr;
+    auto to = label ? label->c_str() : target;
+    char buf[128];
+    switch (d.op)
+    {
+    case op_codes::op_add:
+    case op_codes::op_and:
+        if (d.mode)
+            snprintf(buf, sizeof(buf), "%s R%d, R%d, #%d", op_name(d.op), d.dr, d.sr1, static_cast<int16_t>(d.imm));
+        else
+            snprintf(buf, sizeof(buf), "%s R%d, R%d, R%d", op_name(d.op), d.dr, d.sr1, d.sr2);
+        break;
+    case op_codes::op_not:
+        snprintf(buf, sizeof(buf), "NOT R%d, R%d", d.dr, d.sr1);
+        break;
+    case op_codes::op_br:
+        if (d.dr == 0)
+            snprintf(buf, sizeof(buf), "NOP");
+        else
+            snprintf(buf, sizeof(buf), "BR%s%s%s %s", d.dr & 4 ? "n" : "", d.dr & 2 ? "z" : "",
+                d.dr & 1 ? "p" : "", to);
+        break;
+    case op_codes::op_ld:
+    case op_codes::op_ldi:
+    case op_codes::op_lea:
+    case op_codes::op_st:
+    case op_codes::op_sti:
+        snprintf(buf, sizeof(buf), "%s R%d, %s", op_name(d.op), d.dr, to);
+        break;
+    case op_codes::op_ldr:
+    case op_codes::op_str:
+        snprintf(buf, sizeof(buf), "%s R%d, R%d, #%d", op_name(d.op), d.dr, d.sr1, static_cast<int16_t>(d.imm));
+        break;
+    case op_codes::op_jmp:
+        if (d.sr1 == 7)
+            snprintf(buf, sizeof(buf), "RET");
+        else
+            snprintf(buf, sizeof(buf), "JMP R%d", d.sr1);
+        break;
+    case op_codes::op_jsr:
+        if (d.mode)
+            snprintf(buf, sizeof(buf), "JSR %s", to);
+        else
+            snprintf(buf, sizeof(buf), "JSRR R%d", d.sr1);
+        break;
+    case op_codes::op_trap:
+        if (d.imm >= 0x20 && d.imm <= 0x25)
+            snprintf(buf, sizeof(buf), "%s", traps[d.imm - 0x20]);
+        else if (d.imm >= 0x30 && d.imm <= 0x32)
+            snprintf(buf, sizeof(buf), "%s", bulk_traps[d.imm - 0x30]);
+        else
+            snprintf(buf, sizeof(buf), "TRAP x%02X", d.imm);
+        break;
+    default:
+        snprintf(buf, sizeof(buf), "%s", op_name(d.op));
+        break;
+    }
+    return buf;
+}
@@ -0,0 +1,18 @@
+#ifndef __disasm_h__
+#define __disasm_h__
+
+#include "op_codes.h"
+
+class symbol_table;
+
+#include <stdint.h>
+#include <string>
+
+const char *op_name(op_codes op);
+
+// One instruction in assembler syntax, pc is the address it sits at so
+// pc relative operands come out as absolute addresses, or as the label at
+// that address when symbols has one.
+std::string disassemble(uint16_t pc, uint16_t inst, const symbol_table *symbols = nullptr);
+
+#endif // __disasm_h__
@@ -0,0 +1,214 @@
+#include "extension.h"
+
+#include "flags.h"
+#include "vm.h"
+#include "../tools/ExtensionSample/LC3Extension.h"
+
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace
+{
+    // the vm inside an ExecuteReservedOpcode3/FireInterrupt3 call, the
+    // callbacks of LC3Extension.h carry no context
+    thread_local vm *current = nullptr;
+
+    struct in_call
+    {
+        explicit in_call(vm &machine)
+        {
+            current = &machine;
+        }
+
+        ~in_call()
+        {
+            current = nullptr;
+        }
+    };
+}
+
+extension::extension()
+    : library_(nullptr), execute3_(nullptr), fire3_(nullptr), execute_(nullptr), fire_(nullptr)
+{
+}
+
+extension::~extension()
+{
+    close();
+}
+
+bool extension::open(const char *path)
+{
+    static_assert(std::is_same<get_value, GetValueMethod>::value, "LC3Extension.h signature");
+    static_assert(std::is_same<set_value, SetValueMethod>::value, "LC3Extension.h signature");
+    static_assert(LC3_PC == registers::pc && LC3_CC == registers::cond, "lc3_native.h register layout");
+
+    close();
+    error_.clear();
+#ifdef _WIN32
+    library_ = LoadLibraryA(path);
+#else
+    library_ = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+#endif
+    if (library_ == nullptr)
+    {
+        error_ = std::string("cannot load ") + path;
+        return false;
+    }
+
+    auto version = reinterpret_cast<version_fn>(symbol("lc3_native_version"));
+    if (version != nullptr && version() == LC3_NATIVE_VERSION)
+    {
+        execute_ = reinterpret_cast<execute_fn>(symbol("lc3_execute"));
+        fire_ = reinterpret_cast<fire_fn>(symbol("lc3_fire_interrupt"));
+    }
+    execute3_ = reinterpret_cast<execute3_fn>(symbol("ExecuteReservedOpcode3"));
+    fire3_ = reinterpret_cast<fire3_fn>(symbol("FireInterrupt3"));
+    if (execute_ == nullptr && execute3_ == nullptr)
+    {
+        error_ = std::string(path) + ": exports neither lc3_execute nor ExecuteReservedOpcode3";
+        close();
+        return false;
+    }
+    return true;
+}
+
+const std::string &extension::error() const
+{
+    return error_;
+}
+
+bool extension::native() const
+{
+    return execute_ != nullptr;
+}
+
+bool extension::fires_interrupts() const
+{
+    return fire_ != nullptr || fire3_ != nullptr;
+}
+
+void extension::execute(vm &machine, const decoded &inst)
+{
+    if (execute_ != nullptr)
+    {
+        auto ctx = context(machine, inst.inst);
+        machine.store_cond();
+        execute_(&ctx);
+        machine.load_cond();
+        return;
+    }
+    in_call call(machine);
+    execute3_(&extension::get, &extension::set);
+}
+
+int extension::fire(vm &machine)
+{
+    int vector = NO_INTERRUPT;
+    if (fire_ != nullptr)
+    {
+        auto ctx = context(machine, 0);
+        machine.store_cond();
+        vector = fire_(&ctx);
+    }
+    else if (fire3_ != nullptr)
+    {
+        in_call call(machine);
+        vector = fire3_(&extension::get);
+    }
+    return vector >= 0x80 && vector <= 0xFF ? vector : -1;
+}
+
+void extension::close()
+{
+    if (library_ != nullptr)
+    {
+#ifdef _WIN32
+        FreeLibrary(static_cast<HMODULE>(library_));
+#else
+        dlclose(library_);
+#endif
+    }
+    library_ = nullptr;
+    execute3_ = nullptr;
+    fire3_ = nullptr;
+    execute_ = nullptr;
+    fire_ = nullptr;
+}
+
+void *extension::symbol(const char *name)
+{
+#ifdef _WIN32
+    return reinterpret_cast<void *>(GetProcAddress(static_cast<HMODULE>(library_), name));
+#else
+    return dlsym(library_, name);
+#endif
+}
+
+lc3_context extension::context(vm &machine, uint16_t instruction)
+{
+    return { machine.registers_.data(), machine.memory_.get(), instruction, &extension::written, &machine };
+}
+
+void extension::written(lc3_context *ctx, uint16_t address, uint32_t count)
+{
+    static_cast<vm *>(ctx->host)->rewritten(address, count);
+}
+
+// GetValueMethod: registers are LCEXT_R0 (-1) to LCEXT_PSR (-10), anything
+// from 0 is a memory address and reads devices like the program would
+int extension::get(int location, uint16_t &value)
+{
+    if (current == nullptr)
+        return LCEXT_NOT_IN_CALL;
+    auto &m = *current;
+    if (location >= LCEXT_R7 && location <= LCEXT_R0)
+        value = m.registers_[LCEXT_R0 - location];
+    else if (location == LCEXT_PC)
+        value = m.pc();
+    else if (location == LCEXT_PSR)
+        value = m.reg(registers::psr);
+    else if (location >= 0 && location <= 0xFFFF)
+        value = m.memory_.read(static_cast<uint16_t>(location));
+    else
+        return LCEXT_INVALID_LOCATION;
+    return LCEXT_SUCCESS;
+}
+
+int extension::set(int location, uint16_t value)
+{
+    if (current == nullptr)
+        return LCEXT_NOT_IN_CALL;
+    auto &m = *current;
+    if (location >= LCEXT_R7 && location <= LCEXT_R0)
+    {
+        m.registers_[LCEXT_R0 - location] = value;
+    }
+    else if (location == LCEXT_PC)
+    {
+        m.pc() = value;
+    }
+    else if (location == LCEXT_PSR)
+    {
+        // privilege, priority and exactly one condition code
+        auto cc = value & 0x0007;
+        if ((value & ~0x8707) != 0 || (cc != flags::neg && cc != flags::zero && cc != flags::pos))
+            return LCEXT_INVALID_VALUE;
+        m.set_psr(value);
+    }
+    else if (location >= 0 && location <= 0xFFFF)
+    {
+        m.store(static_cast<uint16_t>(location), value);
+    }
+    else
+    {
+        return LCEXT_INVALID_LOCATION;
+    }
+    return LCEXT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#ifndef __extension_h__
+#define __extension_h__
+
+#define LC3_NATIVE_HOST
+#include "lc3_native.h"
+#include "decode_cache.h"
+
+#include <stdint.h>
+#include <string>
+
+class vm;
+
+// A shared library implementing the reserved opcode, and maybe firing
+// interrupts, attached with vm::set_extension(). It either has the entry
+// points of the LC-3 Simulator's LC3Extension.h (ExecuteReservedOpcode3 and
+// FireInterrupt3) or those of lc3_native.h; the native ones win when a
+// library has both.
+class extension
+{
+public:
+    // the priority fired interrupts are raised at
+    static const int priority = 1;
+
+    extension();
+    ~extension();
+    extension(const extension &) = delete;
+    extension &operator=(const extension &) = delete;
+
+    // error() says why it failed
+    bool open(const char *path);
+    const std::string &error() const;
+    bool native() const;
+    bool fires_interrupts() const;
+
+    // called by the vm with pc past the instruction
+    void execute(vm &machine, const decoded &inst);
+    // an interrupt vector, or -1
+    int fire(vm &machine);
+
+private:
+    typedef int (*get_value)(int location, uint16_t &value);
+    typedef int (*set_value)(int location, uint16_t value);
+    typedef void (*execute3_fn)(get_value get, set_value set);
+    typedef int (*fire3_fn)(get_value get);
+    typedef int (*version_fn)();
+    typedef void (*execute_fn)(lc3_context *ctx);
+    typedef int (*fire_fn)(const lc3_context *ctx);
+
+    void close();
+    void *symbol(const char *name);
+    lc3_context context(vm &machine, uint16_t instruction);
+    static void written(lc3_context *ctx, uint16_t address, uint32_t count);
+    static int get(int location, uint16_t &value);
+    static int set(int location, uint16_t value);
+
+private:
+    void *library_;
+    std::string error_;
+    execute3_fn execute3_;
+    fire3_fn fire3_;
+    execute_fn execute_;
+    fire_fn fire_;
+};
+
+#endif // __extension_h__
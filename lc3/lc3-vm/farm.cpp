@@ -0,0 +1,310 @@
+#include "farm.h"
+
+#include <algorithm>
+
+farm::instance::instance()
+    : input(new queued_input()), output(new capture_sink()),
+    machine(std::unique_ptr<input_source>(input),
+        std::unique_ptr<output_buffer>(new output_buffer(std::unique_ptr<output_sink>(output), 256))),
+    status(state::ready), reason(exit_reason::budget), host_wait(false), woken(false), cancelled(false)
+{
+    // a farm runs far more vms than it has cores, compiled code would not
+    // be shared and costs a code buffer per vm
+    machine.use_jit(false);
+}
+
+farm::farm(size_t threads, uint64_t quantum)
+    : quantum_(quantum), next_queue_(0), queued_(0), sleeping_(0), active_(0), stopping_(false)
+{
+    if (threads == 0)
+    {
+        threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers_.emplace_back(new worker());
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers_[i]->thread = std::thread(&farm::run, this, i);
+    }
+}
+
+farm::~farm()
+{
+    {
+        std::lock_guard<std::mutex> lock(idle_lock_);
+        stopping_ = true;
+        work_.notify_all();
+    }
+    for (auto &w : workers_)
+    {
+        w->thread.join();
+    }
+}
+
+farm::handle farm::add(const object_image &image)
+{
+    auto job = new instance();
+    job->machine.load(image);
+    job->machine.set_entry(image.origin);
+    return start(job);
+}
+
+farm::handle farm::add(const object_set &objects)
+{
+    auto job = new instance();
+    job->machine.load(objects);
+    job->machine.set_entry(objects.entry());
+    return start(job);
+}
+
+farm::handle farm::start(instance *job)
+{
+    job->machine.reset();
+    handle id;
+    {
+        std::lock_guard<std::mutex> lock(instances_lock_);
+        id = instances_.size();
+        instances_.emplace_back(job);
+        for (auto &t : traps_)
+        {
+            // native routines run before host ones, the farm's must win
+            job->machine.native_trap(t.first, false);
+            auto routine = t.second;
+            job->machine.set_host_trap(t.first, [job, id, routine](vm &machine)
+            {
+                // only the thread running the vm touches host_wait
+                job->host_wait = !routine(id, machine);
+                return !job->host_wait;
+            });
+        }
+    }
+    activate();
+    schedule(job, next_queue_++ % workers_.size());
+    return id;
+}
+
+void farm::feed(handle id, const std::string &keys)
+{
+    find(id)->input->push(keys);
+    wake(id);
+}
+
+void farm::close_input(handle id)
+{
+    auto job = find(id);
+    job->input->close();
+    std::lock_guard<std::mutex> lock(job->lock);
+    if (job->status == state::parked && !job->host_wait)
+    {
+        job->status = state::finished;
+        job->reason = exit_reason::blocked;
+    }
+}
+
+void farm::set_trap(uint8_t vector, trap_routine routine)
+{
+    std::lock_guard<std::mutex> lock(instances_lock_);
+    traps_.emplace_back(vector, std::move(routine));
+}
+
+void farm::wake(handle id)
+{
+    auto job = find(id);
+    {
+        std::lock_guard<std::mutex> lock(job->lock);
+        if (job->status != state::parked)
+        {
+            // still running, it sees the keys when it next polls and tries
+            // its trap again before it parks
+            job->woken = true;
+            return;
+        }
+        job->status = state::ready;
+    }
+    activate();
+    schedule(job, next_queue_++ % workers_.size());
+}
+
+void farm::cancel(handle id)
+{
+    auto job = find(id);
+    std::lock_guard<std::mutex> lock(job->lock);
+    if (job->status == state::finished || job->cancelled)
+        return;
+    job->cancelled = true;
+    if (job->status == state::parked)
+    {
+        job->status = state::finished;
+        job->reason = exit_reason::paused;
+        return;
+    }
+    // running or queued, its next run_for() stops as paused
+    job->machine.pause();
+}
+
+void farm::wait()
+{
+    std::unique_lock<std::mutex> lock(idle_lock_);
+    idle_.wait(lock, [this] { return active_ == 0; });
+}
+
+size_t farm::size()
+{
+    std::lock_guard<std::mutex> lock(instances_lock_);
+    return instances_.size();
+}
+
+farm::state farm::status(handle id)
+{
+    auto job = find(id);
+    std::lock_guard<std::mutex> lock(job->lock);
+    return job->status;
+}
+
+exit_reason farm::reason(handle id)
+{
+    auto job = find(id);
+    std::lock_guard<std::mutex> lock(job->lock);
+    return job->status == state::ready ? exit_reason::budget : job->reason;
+}
+
+uint64_t farm::executed(handle id)
+{
+    auto job = find(id);
+    std::lock_guard<std::mutex> lock(job->lock);
+    return job->status == state::ready ? 0 : job->machine.executed();
+}
+
+std::string farm::output(handle id)
+{
+    auto job = find(id);
+    std::lock_guard<std::mutex> lock(job->lock);
+    return job->status == state::ready ? std::string() : job->output->str();
+}
+
+farm::instance *farm::find(handle id)
+{
+    std::lock_guard<std::mutex> lock(instances_lock_);
+    return instances_.at(id).get();
+}
+
+void farm::schedule(instance *job, size_t queue)
+{
+    {
+        auto &w = *workers_[queue];
+        std::lock_guard<std::mutex> lock(w.lock);
+        w.tasks.push_back(job);
+    }
+    ++queued_;
+    // only pay for the lock when a worker may be asleep
+    if (sleeping_ > 0)
+    {
+        std::lock_guard<std::mutex> lock(idle_lock_);
+        work_.notify_one();
+    }
+}
+
+bool farm::next(size_t self, instance *&job)
+{
+    while (!stopping_)
+    {
+        // oldest first from our own queue so the slices go round robin
+        {
+            auto &w = *workers_[self];
+            std::lock_guard<std::mutex> lock(w.lock);
+            if (!w.tasks.empty())
+            {
+                job = w.tasks.front();
+                w.tasks.pop_front();
+                --queued_;
+                return true;
+            }
+        }
+        // steal from the far end of the others
+        for (size_t i = 1; i < workers_.size(); ++i)
+        {
+            auto &victim = *workers_[(self + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                job = victim.tasks.back();
+                victim.tasks.pop_back();
+                --queued_;
+                return true;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(idle_lock_);
+        ++sleeping_;
+        work_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+        --sleeping_;
+    }
+    return false;
+}
+
+void farm::run(size_t self)
+{
+    instance *job;
+    while (next(self, job))
+    {
+        // a vm that never halts must not hold up the destructor, it is
+        // dropped as it is
+        while (!stopping_ && slice(job))
+        {
+            if (queued_ > 0)
+            {
+                // others are waiting for a turn
+                schedule(job, self);
+                break;
+            }
+        }
+    }
+}
+
+// Runs one quantum, returns true while the vm is still runnable.
+bool farm::slice(instance *job)
+{
+    auto reason = job->machine.run_for(quantum_);
+    if (reason == exit_reason::budget)
+    {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(job->lock);
+    if (reason == exit_reason::blocked && !job->cancelled)
+    {
+        if (job->host_wait ? job->woken : job->input->ready())
+        {
+            // fed or woken while we were running
+            job->woken = false;
+            return true;
+        }
+        job->woken = false;
+        job->status = !job->host_wait && job->input->closed() ? state::finished : state::parked;
+    }
+    else
+    {
+        job->status = state::finished;
+    }
+    // a cancelled vm that did not halt on its own was stopped
+    job->reason = job->cancelled && reason != exit_reason::halted ? exit_reason::paused : reason;
+    job->machine.output().flush();
+    deactivate();
+    return false;
+}
+
+void farm::activate()
+{
+    ++active_;
+}
+
+void farm::deactivate()
+{
+    if (--active_ == 0)
+    {
+        std::lock_guard<std::mutex> lock(idle_lock_);
+        idle_.notify_all();
+    }
+}
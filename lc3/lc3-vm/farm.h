@@ -0,0 +1,111 @@
+#ifndef __farm_h__
+#define __farm_h__
+
+#include "vm.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hosts many headless vms in one process. Runnable vms are time sliced in
+// fixed instruction quanta on a thread per core; every thread owns a queue
+// and steals from the others once it runs dry. A vm that blocks on GETC/IN
+// is parked until feed() hands it more input, one that blocks in a host trap
+// until wake(); a parked vm holds no thread and resumes on whichever thread
+// is free by running its TRAP again.
+class farm
+{
+public:
+    typedef size_t handle;
+    // see host_trap, id is the vm the routine runs for
+    typedef std::function<bool(handle id, vm &machine)> trap_routine;
+
+    enum class state
+    {
+        ready,      // queued or running
+        parked,     // blocked on input
+        finished
+    };
+
+    explicit farm(size_t threads = 0, uint64_t quantum = 10000);
+    ~farm();
+
+    handle add(const object_image &image);
+    handle add(const object_set &objects);
+    void feed(handle id, const std::string &keys);
+    void close_input(handle id);
+    // installs routine in every vm added after the call, in place of the
+    // native routine if vector has one (GETC, OUT, HALT...)
+    void set_trap(uint8_t vector, trap_routine routine);
+    // makes a vm parked in a host trap runnable, or has a running one try
+    // its trap again before it parks
+    void wake(handle id);
+    // stops a vm wherever it is, for one that never halts; it finishes
+    // with exit_reason::paused
+    void cancel(handle id);
+    // blocks until every vm has finished or is parked
+    void wait();
+
+    size_t size();
+    state status(handle id);
+    // the accessors below only report a vm that is parked or finished
+    exit_reason reason(handle id);
+    uint64_t executed(handle id);
+    std::string output(handle id);
+
+private:
+    struct instance
+    {
+        instance();
+
+        queued_input *input;
+        capture_sink *output;
+        vm machine;
+        std::mutex lock;
+        state status;
+        exit_reason reason;
+        bool host_wait;     // blocked in a host trap rather than on input
+        bool woken;
+        bool cancelled;
+    };
+
+    struct worker
+    {
+        std::mutex lock;
+        std::deque<instance *> tasks;
+        std::thread thread;
+    };
+
+    handle start(instance *job);
+    instance *find(handle id);
+    void schedule(instance *job, size_t queue);
+    bool next(size_t self, instance *&job);
+    void run(size_t self);
+    bool slice(instance *job);
+    void activate();
+    void deactivate();
+
+private:
+    uint64_t quantum_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::vector<std::unique_ptr<instance>> instances_;
+    std::vector<std::pair<uint8_t, trap_routine>> traps_;
+    std::mutex instances_lock_;     // and traps_
+    std::atomic<size_t> next_queue_;
+    std::atomic<size_t> queued_;
+    std::atomic<size_t> sleeping_;
+    std::atomic<size_t> active_;    // vms that are ready
+    std::atomic<bool> stopping_;
+    std::mutex idle_lock_;
+    std::condition_variable work_;
+    std::condition_variable idle_;
+};
+
+#endif // __farm_h__
@@ -1,12 +1,32 @@
 #ifndef __flags_h__
 #define __flags_h__
 
+#include <stdint.h>
+
 enum flags : uint16_t
 {
-    pos  = 0,
+    pos  = 1,
     zero = 2,
     neg  = 4
 };
 
+// Condition codes of a result value, and a value that produces the given
+// condition codes. Every engine keeps the flags as the last result; BR works
+// them out with no branch of its own.
+inline uint16_t cc_flags(uint16_t value)
+{
+    uint16_t n = value >> 15;
+    uint16_t z = value == 0;
+    return static_cast<uint16_t>((n << 2) | (z << 1) | (1 ^ (n | z)));
+}
+
+inline uint16_t cc_value(uint16_t cond)
+{
+    if (cond & flags::neg)
+        return 0x8000;
+    if (cond & flags::zero)
+        return 0;
+    return 1;
+}
 
 #endif // __flags_h__
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "input.h"
+
+#include "console.h"
+
+#include <chrono>
+
+bool key_ring::push(uint16_t key)
+{
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == capacity)
+    {
+        return false;
+    }
+    keys_[head % capacity] = key;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool key_ring::pop(uint16_t &key)
+{
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail)
+    {
+        return false;
+    }
+    key = keys_[tail % capacity];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+console_input::console_input()
+    : running_(true), closed_(false)
+{
+    console_raw_mode(true);
+    thread_ = std::thread(&console_input::reader, this);
+}
+
+console_input::~console_input()
+{
+    running_ = false;
+    thread_.join();
+    console_raw_mode(false);
+}
+
+bool console_input::ready()
+{
+    return !keys_.empty();
+}
+
+bool console_input::poll(uint16_t &key)
+{
+    return keys_.pop(key);
+}
+
+bool console_input::wait()
+{
+    if (!keys_.empty())
+    {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(lock_);
+    arrived_.wait(lock, [this] { return !keys_.empty() || closed_; });
+    return !keys_.empty();
+}
+
+void console_input::reader()
+{
+    while (running_)
+    {
+        uint16_t key;
+        auto result = console_key(100, key);
+        if (result == key_result::closed)
+        {
+            break;
+        }
+        if (result != key_result::key)
+        {
+            continue;
+        }
+        // a full ring waits for the vm to take keys rather than dropping
+        // them, piped input easily runs ahead of the program
+        bool pushed;
+        while (!(pushed = keys_.push(key)) && running_)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (pushed)
+        {
+            {
+                std::lock_guard<std::mutex> lock(lock_);
+                arrived_.notify_one();
+            }
+            arrived();
+        }
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    closed_ = true;
+    arrived_.notify_all();
+}
+
+queued_input::queued_input()
+    : closed_(false)
+{
+}
+
+void queued_input::push(const std::string &keys)
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (auto c : keys)
+        {
+            keys_.push_back(static_cast<uint8_t>(c));
+        }
+        arrived_.notify_all();
+    }
+    arrived();
+}
+
+void queued_input::close()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    closed_ = true;
+    arrived_.notify_all();
+}
+
+bool queued_input::closed()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return closed_;
+}
+
+bool queued_input::ready()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return !keys_.empty();
+}
+
+bool queued_input::poll(uint16_t &key)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    if (keys_.empty())
+    {
+        return false;
+    }
+    key = keys_.front();
+    keys_.pop_front();
+    return true;
+}
+
+bool queued_input::wait()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    arrived_.wait(lock, [this] { return !keys_.empty() || closed_; });
+    return !keys_.empty();
+}
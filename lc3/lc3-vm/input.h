@@ -0,0 +1,121 @@
+#ifndef __input_h__
+#define __input_h__
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Where the keyboard device and the GETC/IN traps take their keys from.
+class input_source
+{
+public:
+    virtual ~input_source() {}
+    virtual bool ready() = 0;
+    virtual bool poll(uint16_t &key) = 0;
+    // blocks until a key is ready, returns false once the source is closed
+    virtual bool wait() = 0;
+
+    // For sources that hand out keys at instruction counts rather than when
+    // they arrive: the vm calls advance() before every slice it runs and ends
+    // the slice at due(), which is past now. Live sources ignore both.
+    virtual void advance(uint64_t now)
+    {
+    }
+
+    virtual uint64_t due(uint64_t now)
+    {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    // called from whichever thread delivers keys, after they are ready; set
+    // it before the vm runs
+    void set_listener(std::function<void()> listener)
+    {
+        listener_ = std::move(listener);
+    }
+
+protected:
+    void arrived()
+    {
+        if (listener_)
+            listener_();
+    }
+
+private:
+    std::function<void()> listener_;
+};
+
+// Single producer, single consumer ring of keys.
+class key_ring
+{
+public:
+    static const uint32_t capacity = 256;
+
+    bool push(uint16_t key);
+    bool pop(uint16_t &key);
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<uint16_t, capacity> keys_;
+    std::atomic<uint32_t> head_ = { 0 };    // written by the producer
+    std::atomic<uint32_t> tail_ = { 0 };    // written by the consumer
+};
+
+// Console keyboard. A reader thread puts the console in raw mode and feeds
+// the ring, so checking for a key never blocks the vm.
+class console_input : public input_source
+{
+public:
+    console_input();
+    ~console_input();
+
+    bool ready() override;
+    bool poll(uint16_t &key) override;
+    bool wait() override;
+
+private:
+    void reader();
+
+private:
+    key_ring keys_;
+    std::atomic<bool> running_;
+    std::atomic<bool> closed_;
+    std::mutex lock_;
+    std::condition_variable arrived_;
+    std::thread thread_;
+};
+
+// Keys handed in by the host, for vms without a console. Any thread may
+// push; once closed, a vm that runs out of keys stays blocked.
+class queued_input : public input_source
+{
+public:
+    queued_input();
+
+    void push(const std::string &keys);
+    void close();
+    bool closed();
+
+    bool ready() override;
+    bool poll(uint16_t &key) override;
+    bool wait() override;
+
+private:
+    std::deque<uint16_t> keys_;
+    bool closed_;
+    std::mutex lock_;
+    std::condition_variable arrived_;
+};
+
+#endif // __input_h__
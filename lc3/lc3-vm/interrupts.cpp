@@ -0,0 +1,90 @@
+#include "interrupts.h"
+
+interrupt_controller::interrupt_controller()
+    : pending_(0)
+{
+}
+
+void interrupt_controller::raise(uint8_t vector, int priority)
+{
+    priority &= 7;
+    std::lock_guard<std::mutex> lock(lock_);
+    lines_[priority].set(vector);
+    pending_.fetch_or(1u << priority, std::memory_order_release);
+}
+
+void interrupt_controller::clear()
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    for (auto &l : lines_)
+    {
+        l.reset();
+    }
+    pending_.store(0, std::memory_order_release);
+}
+
+const std::atomic<uint32_t> *interrupt_controller::pending_word() const
+{
+    return &pending_;
+}
+
+bool interrupt_controller::take(int level, uint8_t &vector, int &priority)
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    for (int p = 7; p > level; --p)
+    {
+        auto &lines = lines_[p];
+        if (lines.none())
+            continue;
+        for (int v = 0; v < 256; ++v)
+        {
+            if (lines.test(v))
+            {
+                lines.reset(v);
+                if (lines.none())
+                    pending_.fetch_and(~(1u << p), std::memory_order_relaxed);
+                vector = static_cast<uint8_t>(v);
+                priority = p;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void interrupt_controller::request_stop()
+{
+    pending_.fetch_or(stop_request, std::memory_order_release);
+}
+
+bool interrupt_controller::take_stop()
+{
+    return (pending_.fetch_and(~stop_request, std::memory_order_acquire) & stop_request) != 0;
+}
+
+interval_timer::interval_timer(interrupt_controller &target, uint8_t vector, int priority, std::chrono::milliseconds period)
+    : target_(target), vector_(vector), priority_(priority), period_(period)
+{
+    thread_ = std::thread(&interval_timer::tick, this);
+}
+
+interval_timer::~interval_timer()
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopping_ = true;
+    }
+    stop_.notify_all();
+    thread_.join();
+}
+
+void interval_timer::tick()
+{
+    auto next = std::chrono::steady_clock::now() + period_;
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!stop_.wait_until(lock, next, [this] { return stopping_; }))
+    {
+        target_.raise(vector_, priority_);
+        next += period_;
+    }
+}
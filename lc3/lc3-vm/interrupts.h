@@ -0,0 +1,71 @@
+#ifndef __interrupts_h__
+#define __interrupts_h__
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Interrupt lines of one vm. Devices raise a line from any thread; that only
+// sets a bit in one word, which the vm compares against the running priority
+// between instructions (between blocks in the JIT). A raised line stays
+// pending until the vm takes it, the highest priority first.
+class interrupt_controller
+{
+public:
+    interrupt_controller();
+
+    // vector x80-xFF for devices, priority 1-7; PL0 never interrupts anything
+    void raise(uint8_t vector, int priority);
+    void clear();
+
+    // bit n is set while a line of priority n is pending
+    uint32_t pending() const
+    {
+        return pending_.load(std::memory_order_relaxed);
+    }
+    const std::atomic<uint32_t> *pending_word() const;
+
+    // takes the highest priority line above level, lowest vector first
+    bool take(int level, uint8_t &vector, int &priority);
+
+    // Not an interrupt: a bit above every priority that makes the vm stop at
+    // the next point it checks for interrupts. Debugging uses it to stop a
+    // vm from another thread or from inside an instruction.
+    static const uint32_t stop_request = 1u << 8;
+    void request_stop();
+    bool take_stop();
+
+private:
+    std::mutex lock_;
+    std::array<std::bitset<256>, 8> lines_;
+    std::atomic<uint32_t> pending_;
+};
+
+// Raises a line every period of host time from its own thread, so the vm
+// never has to look at the clock.
+class interval_timer
+{
+public:
+    interval_timer(interrupt_controller &target, uint8_t vector, int priority, std::chrono::milliseconds period);
+    ~interval_timer();
+
+private:
+    void tick();
+
+private:
+    interrupt_controller &target_;
+    uint8_t vector_;
+    int priority_;
+    std::chrono::milliseconds period_;
+    bool stopping_ = false;
+    std::mutex lock_;
+    std::condition_variable stop_;
+    std::thread thread_;
+};
+
+#endif // __interrupts_h__
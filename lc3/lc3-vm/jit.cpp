@@ -0,0 +1,613 @@
+#include "jit.h"
+
+#ifdef LC3_JIT
+
+#include "decode_cache.h"
+#include "flags.h"
+#include "memory.h"
+#include "op_codes.h"
+#include "vm.h"
+
+#include <stdexcept>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    const size_t code_size = 4 * 1024 * 1024;
+    const size_t block_reserve = 16 * 1024;
+    const int max_block = 64;
+
+    enum host
+    {
+        rax = 0, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+        r8, r9, r10, r11, r12, r13, r14, r15
+    };
+
+    enum conditions
+    {
+        cc_e = 0x4,
+        cc_ne = 0x5,
+        cc_a = 0x7,
+        cc_s = 0x8,
+        cc_l = 0xC,
+        cc_ge = 0xD,
+        cc_le = 0xE,
+        cc_g = 0xF
+    };
+
+    // LC-3 register n is pinned to host register r8 + n
+    int host_reg(uint8_t reg)
+    {
+        return r8 + reg;
+    }
+
+    uint8_t modrm(int mod, int reg, int rm)
+    {
+        return static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    static_assert(offsetof(jit_frame, regs) == 0, "jit_frame layout");
+    static_assert(offsetof(jit_frame, memory) == 8, "jit_frame layout");
+    static_assert(offsetof(jit_frame, code_map) == 16, "jit_frame layout");
+    static_assert(offsetof(jit_frame, budget) == 24, "jit_frame layout");
+    static_assert(offsetof(jit_frame, cc) == 32, "jit_frame layout");
+    static_assert(offsetof(jit_frame, device_pages) == 40, "jit_frame layout");
+    static_assert(offsetof(jit_frame, dirty_pages) == 48, "jit_frame layout");
+    static_assert(offsetof(jit_frame, interrupts) == 56, "jit_frame layout");
+    static_assert(offsetof(jit_frame, level_mask) == 64, "jit_frame layout");
+}
+
+jit::jit()
+    : blocks_(0x10000, nullptr), code_map_(0x10000, 0)
+{
+#ifdef _WIN32
+    code_ = static_cast<uint8_t *>(VirtualAlloc(nullptr, code_size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+#else
+    void *p = mmap(nullptr, code_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    code_ = p == MAP_FAILED ? nullptr : static_cast<uint8_t *>(p);
+#endif
+    if (code_ == nullptr)
+        throw std::runtime_error("failed to allocate jit code buffer");
+    cursor_ = code_;
+    end_ = code_ + code_size;
+
+    // enter(frame, block): save callee saved registers (for both the SysV
+    // and Windows conventions), load the frame and jump into the block
+    enter_ = reinterpret_cast<uint32_t (*)(jit_frame *, const uint8_t *)>(cursor_);
+    emit8(0x53);                            // push rbx
+    emit8(0x55);                            // push rbp
+    emit8(0x57);                            // push rdi
+    emit8(0x56);                            // push rsi
+    emit8(0x41); emit8(0x54);               // push r12
+    emit8(0x41); emit8(0x55);               // push r13
+    emit8(0x41); emit8(0x56);               // push r14
+    emit8(0x41); emit8(0x57);               // push r15
+#ifdef _WIN32
+    emit8(0x48); emit8(0x89); emit8(0xCB);  // mov rbx, rcx
+    emit8(0x48); emit8(0x89); emit8(0xD0);  // mov rax, rdx
+#else
+    emit8(0x48); emit8(0x89); emit8(0xFB);  // mov rbx, rdi
+    emit8(0x48); emit8(0x89); emit8(0xF0);  // mov rax, rsi
+#endif
+    emit8(0x48); emit8(0x8B); emit8(0x6B); emit8(0x08);     // mov rbp, [rbx + memory]
+    emit8(0x48); emit8(0x8B); emit8(0x0B);                  // mov rcx, [rbx + regs]
+    for (int i = 0; i < 8; ++i)
+    {
+        // movzx r8d + i, word [rcx + i * 2]
+        emit8(0x44); emit8(0x0F); emit8(0xB7); emit8(modrm(1, i, rcx)); emit8(static_cast<uint8_t>(i * 2));
+    }
+    emit8(0x48); emit8(0x8B); emit8(0x7B); emit8(0x18);     // mov rdi, [rbx + budget]
+    emit8(0x8B); emit8(0x73); emit8(0x20);                  // mov esi, [rbx + cc]
+    emit8(0xFF); emit8(0xE0);                               // jmp rax
+
+    // exit: eax holds the next pc, write the pinned state back to the frame
+    exit_ = cursor_;
+    emit8(0x48); emit8(0x8B); emit8(0x0B);                  // mov rcx, [rbx + regs]
+    for (int i = 0; i < 8; ++i)
+    {
+        // mov word [rcx + i * 2], r8w + i
+        emit8(0x66); emit8(0x44); emit8(0x89); emit8(modrm(1, i, rcx)); emit8(static_cast<uint8_t>(i * 2));
+    }
+    emit8(0x48); emit8(0x89); emit8(0x7B); emit8(0x18);     // mov [rbx + budget], rdi
+    emit8(0x89); emit8(0x73); emit8(0x20);                  // mov [rbx + cc], esi
+    emit8(0x41); emit8(0x5F);               // pop r15
+    emit8(0x41); emit8(0x5E);               // pop r14
+    emit8(0x41); emit8(0x5D);               // pop r13
+    emit8(0x41); emit8(0x5C);               // pop r12
+    emit8(0x5E);                            // pop rsi
+    emit8(0x5F);                            // pop rdi
+    emit8(0x5D);                            // pop rbp
+    emit8(0x5B);                            // pop rbx
+    emit8(0xC3);                            // ret
+
+    blocks_start_ = cursor_;
+}
+
+jit::~jit()
+{
+#ifdef _WIN32
+    VirtualFree(code_, 0, MEM_RELEASE);
+#else
+    munmap(code_, code_size);
+#endif
+}
+
+uint32_t jit::run(jit_frame &frame, uint16_t pc)
+{
+    auto block = blocks_[pc];
+    if (block == nullptr)
+    {
+        block = compile(frame, pc);
+        if (block == nullptr)
+        {
+            return pc | interpret;
+        }
+    }
+    frame.code_map = code_map_.data();
+    return enter_(&frame, block);
+}
+
+bool jit::compiled(uint16_t address) const
+{
+    return code_map_[address] != 0;
+}
+
+const uint8_t *jit::code_map() const
+{
+    return code_map_.data();
+}
+
+void jit::flush()
+{
+    cursor_ = blocks_start_;
+    std::fill(blocks_.begin(), blocks_.end(), nullptr);
+    std::fill(code_map_.begin(), code_map_.end(), 0);
+    links_.clear();
+}
+
+uint8_t *jit::compile(const jit_frame &frame, uint16_t start)
+{
+    auto mem = frame.memory;
+    auto device = [&frame](uint16_t address)
+    {
+        return frame.device_pages[address >> memory::page_bits] != 0;
+    };
+    auto breakpoint = [&frame](uint16_t address)
+    {
+        return frame.breakpoints && frame.breakpoints->breakpoint(address);
+    };
+
+    if (device(start) || breakpoint(start))
+    {
+        return nullptr;
+    }
+    auto first = decode(mem[start]);
+    switch (first.op)
+    {
+    case op_codes::op_trap:
+    case op_codes::op_rti:
+    case op_codes::op_res:
+        return nullptr;
+    case op_codes::op_ld:
+    case op_codes::op_ldi:
+    case op_codes::op_st:
+    case op_codes::op_sti:
+        if (device(static_cast<uint16_t>(start + 1 + first.imm)))
+            return nullptr;
+        break;
+    default:
+        break;
+    }
+
+    if (static_cast<size_t>(end_ - cursor_) < block_reserve)
+    {
+        flush();
+    }
+
+    auto block = cursor_;
+    std::vector<exit_stub> exits;
+
+    // interrupt check, before the budget is taken so the exit gives nothing back
+    emit8(0x48); emit8(0x8B); emit8(0x43); emit8(0x38);     // mov rax, [rbx + interrupts]
+    emit8(0x8B); emit8(0x00);                               // mov eax, [rax]
+    emit8(0x3B); emit8(0x43); emit8(0x40);                  // cmp eax, [rbx + level_mask]
+    exits.push_back({ jcc(cc_a), start, false, -1 });
+
+    // budget check, the instruction count is patched in once it is known
+    emit8(0x48); emit8(0x81); emit8(0xEF);  // sub rdi, imm32
+    auto count_at = cursor_;
+    emit32(0);
+    exits.push_back({ jcc(cc_s), start | budget, false, 0 });
+
+    uint16_t pc = start;
+    int count = 0;
+    bool open = true;
+    while (open)
+    {
+        if (count == max_block || device(pc) || breakpoint(pc))
+        {
+            exits.push_back({ jmp(), pc, true, count });
+            break;
+        }
+
+        auto inst = decode(mem[pc]);
+        uint16_t next = pc + 1;
+        uint16_t target = next + inst.imm;
+        auto dr = host_reg(inst.dr);
+        auto sr1 = host_reg(inst.sr1);
+        auto sr2 = host_reg(inst.sr2);
+
+        switch (inst.op)
+        {
+        case op_codes::op_add:
+        case op_codes::op_and:
+        {
+            uint8_t op = inst.op == op_codes::op_add ? 0x01 : 0x21;
+            uint8_t ext = inst.op == op_codes::op_add ? 0 : 4;
+            if (inst.mode)
+            {
+                if (dr != sr1)
+                    alu_rr32(0x89, dr, sr1);
+                alu_ri16(ext, dr, inst.imm);
+            }
+            else if (dr == sr1)
+            {
+                alu_rr16(op, dr, sr2);
+            }
+            else if (dr == sr2)
+            {
+                alu_rr16(op, dr, sr1);
+            }
+            else
+            {
+                alu_rr32(0x89, dr, sr1);
+                alu_rr16(op, dr, sr2);
+            }
+            set_cc(dr);
+            break;
+        }
+        case op_codes::op_not:
+            if (dr != sr1)
+                alu_rr32(0x89, dr, sr1);
+            not16(dr);
+            set_cc(dr);
+            break;
+        case op_codes::op_lea:
+            mov_ri32(dr, target);
+            set_cc(dr);
+            break;
+        case op_codes::op_ld:
+            if (device(target))
+            {
+                exits.push_back({ jmp(), pc | interpret, false, count });
+                open = false;
+                continue;
+            }
+            load_abs(dr, target);
+            set_cc(dr);
+            break;
+        case op_codes::op_ldi:
+            if (device(target))
+            {
+                exits.push_back({ jmp(), pc | interpret, false, count });
+                open = false;
+                continue;
+            }
+            load_abs(rcx, target);
+            exits.push_back({ check_device_rcx(), pc | interpret, false, count });
+            load_rcx(dr);
+            set_cc(dr);
+            break;
+        case op_codes::op_ldr:
+            address_rcx(sr1, inst.imm);
+            exits.push_back({ check_device_rcx(), pc | interpret, false, count });
+            load_rcx(dr);
+            set_cc(dr);
+            break;
+        case op_codes::op_st:
+            if (device(target))
+            {
+                exits.push_back({ jmp(), pc | interpret, false, count });
+                open = false;
+                continue;
+            }
+            exits.push_back({ check_code_abs(target), pc | interpret, false, count });
+            store_abs(dr, target);
+            break;
+        case op_codes::op_sti:
+            if (device(target))
+            {
+                exits.push_back({ jmp(), pc | interpret, false, count });
+                open = false;
+                continue;
+            }
+            load_abs(rcx, target);
+            exits.push_back({ check_device_rcx(), pc | interpret, false, count });
+            exits.push_back({ check_code_rcx(), pc | interpret, false, count });
+            store_rcx(dr);
+            break;
+        case op_codes::op_str:
+            address_rcx(sr1, inst.imm);
+            exits.push_back({ check_device_rcx(), pc | interpret, false, count });
+            exits.push_back({ check_code_rcx(), pc | interpret, false, count });
+            store_rcx(dr);
+            break;
+        case op_codes::op_br:
+        {
+            static const uint8_t branch_cc[] = { 0, cc_g, cc_e, cc_ge, cc_l, cc_ne, cc_le, 0 };
+            if (inst.dr == 0x7)
+            {
+                exits.push_back({ jmp(), target, true, count + 1 });
+                open = false;
+            }
+            else if (inst.dr != 0)
+            {
+                emit8(0x66); emit8(0x85); emit8(0xF6);  // test si, si
+                exits.push_back({ jcc(branch_cc[inst.dr]), target, true, count + 1 });
+                exits.push_back({ jmp(), next, true, count + 1 });
+                open = false;
+            }
+            break;
+        }
+        case op_codes::op_jmp:
+            alu_rr32(0x89, rax, sr1);
+            patch(jmp(), exit_);
+            open = false;
+            break;
+        case op_codes::op_jsr:
+            if (inst.mode)
+            {
+                mov_ri32(r15, next);
+                exits.push_back({ jmp(), target, true, count + 1 });
+            }
+            else
+            {
+                alu_rr32(0x89, rax, sr1);
+                mov_ri32(r15, next);
+                patch(jmp(), exit_);
+            }
+            open = false;
+            break;
+        default:
+            // trap, rti and the reserved opcode go to the interpreter
+            exits.push_back({ jmp(), pc | interpret, false, count });
+            open = false;
+            continue;
+        }
+
+        ++count;
+        pc = next;
+    }
+
+    memcpy(count_at, &count, sizeof(count));
+    emit_exits(exits, count);
+
+    for (uint16_t a = start; a != pc; ++a)
+    {
+        code_map_[a] = 1;
+    }
+    blocks_[start] = block;
+    link(start, block);
+    return block;
+}
+
+void jit::emit_exits(std::vector<exit_stub> &exits, int count)
+{
+    for (auto &e : exits)
+    {
+        patch(e.jump, cursor_);
+        if (e.executed >= 0 && e.executed != count)
+        {
+            // give back the budget of the instructions that did not run
+            emit8(0x48); emit8(0x81); emit8(0xC7);  // add rdi, imm32
+            emit32(count - e.executed);
+        }
+        auto chained = e.chain ? blocks_[e.target] : nullptr;
+        if (chained != nullptr)
+        {
+            patch(jmp(), chained);
+            continue;
+        }
+        auto stub = cursor_;
+        emit8(0xB8);                        // mov eax, imm32
+        emit32(e.target);
+        patch(jmp(), exit_);
+        if (e.chain)
+        {
+            links_[static_cast<uint16_t>(e.target)].push_back(stub);
+        }
+    }
+}
+
+void jit::link(uint16_t pc, uint8_t *block)
+{
+    auto it = links_.find(pc);
+    if (it == links_.end())
+    {
+        return;
+    }
+    for (auto stub : it->second)
+    {
+        // overwrite mov eax, pc with a direct jump to the block
+        int32_t rel = static_cast<int32_t>(block - (stub + 5));
+        stub[0] = 0xE9;
+        memcpy(stub + 1, &rel, sizeof(rel));
+    }
+    links_.erase(it);
+}
+
+void jit::emit8(uint8_t value)
+{
+    *cursor_++ = value;
+}
+
+void jit::emit16(uint16_t value)
+{
+    memcpy(cursor_, &value, sizeof(value));
+    cursor_ += sizeof(value);
+}
+
+void jit::emit32(uint32_t value)
+{
+    memcpy(cursor_, &value, sizeof(value));
+    cursor_ += sizeof(value);
+}
+
+void jit::rex(bool wide, int reg, int rm)
+{
+    uint8_t r = 0x40 | (wide ? 0x8 : 0) | ((reg & 8) ? 0x4 : 0) | ((rm & 8) ? 0x1 : 0);
+    if (r != 0x40)
+        emit8(r);
+}
+
+void jit::alu_rr16(uint8_t op, int dst, int src)
+{
+    emit8(0x66);
+    rex(false, src, dst);
+    emit8(op);
+    emit8(modrm(3, src, dst));
+}
+
+void jit::alu_rr32(uint8_t op, int dst, int src)
+{
+    rex(false, src, dst);
+    emit8(op);
+    emit8(modrm(3, src, dst));
+}
+
+void jit::alu_ri16(uint8_t ext, int dst, uint16_t imm)
+{
+    emit8(0x66);
+    rex(false, 0, dst);
+    emit8(0x81);
+    emit8(modrm(3, ext, dst));
+    emit16(imm);
+}
+
+void jit::mov_ri32(int dst, uint32_t imm)
+{
+    rex(false, 0, dst);
+    emit8(static_cast<uint8_t>(0xB8 + (dst & 7)));
+    emit32(imm);
+}
+
+void jit::not16(int dst)
+{
+    emit8(0x66);
+    rex(false, 0, dst);
+    emit8(0xF7);
+    emit8(modrm(3, 2, dst));
+}
+
+void jit::load_abs(int dst, uint16_t address)
+{
+    // movzx dst, word [rbp + address * 2]
+    rex(false, dst, rbp);
+    emit8(0x0F); emit8(0xB7);
+    emit8(modrm(2, dst, rbp));
+    emit32(address * 2u);
+}
+
+void jit::load_rcx(int dst)
+{
+    // movzx dst, word [rbp + rcx * 2]
+    rex(false, dst, rbp);
+    emit8(0x0F); emit8(0xB7);
+    emit8(modrm(1, dst, 4));
+    emit8(0x4D);
+    emit8(0);
+}
+
+void jit::store_abs(int src, uint16_t address)
+{
+    // mov word [rbp + address * 2], src
+    emit8(0x66);
+    rex(false, src, rbp);
+    emit8(0x89);
+    emit8(modrm(2, src, rbp));
+    emit32(address * 2u);
+    emit8(0x48); emit8(0x8B); emit8(0x43); emit8(0x30);     // mov rax, [rbx + dirty_pages]
+    emit8(0xC6); emit8(0x80);                               // mov byte [rax + page], 1
+    emit32(address >> memory::page_bits);
+    emit8(1);
+}
+
+void jit::store_rcx(int src)
+{
+    // mov word [rbp + rcx * 2], src
+    emit8(0x66);
+    rex(false, src, rbp);
+    emit8(0x89);
+    emit8(modrm(1, src, 4));
+    emit8(0x4D);
+    emit8(0);
+    emit8(0x89); emit8(0xC8);                               // mov eax, ecx
+    emit8(0xC1); emit8(0xE8); emit8(memory::page_bits);     // shr eax, page_bits
+    emit8(0x48); emit8(0x8B); emit8(0x53); emit8(0x30);     // mov rdx, [rbx + dirty_pages]
+    emit8(0xC6); emit8(0x04); emit8(0x02); emit8(1);        // mov byte [rdx + rax], 1
+}
+
+void jit::address_rcx(int base, uint16_t offset)
+{
+    alu_rr32(0x89, rcx, base);
+    alu_ri16(0, rcx, offset);
+}
+
+size_t jit::check_device_rcx()
+{
+    emit8(0x89); emit8(0xC8);                               // mov eax, ecx
+    emit8(0xC1); emit8(0xE8); emit8(memory::page_bits);     // shr eax, page_bits
+    emit8(0x48); emit8(0x8B); emit8(0x53); emit8(0x28);     // mov rdx, [rbx + device_pages]
+    emit8(0x80); emit8(0x3C); emit8(0x02); emit8(0x00);     // cmp byte [rdx + rax], 0
+    return jcc(cc_ne);
+}
+
+size_t jit::check_code_rcx()
+{
+    emit8(0x48); emit8(0x8B); emit8(0x43); emit8(0x10);     // mov rax, [rbx + code_map]
+    emit8(0x80); emit8(0x3C); emit8(0x08); emit8(0x00);     // cmp byte [rax + rcx], 0
+    return jcc(cc_ne);
+}
+
+size_t jit::check_code_abs(uint16_t address)
+{
+    emit8(0x48); emit8(0x8B); emit8(0x43); emit8(0x10);     // mov rax, [rbx + code_map]
+    emit8(0x80); emit8(0xB8); emit32(address); emit8(0x00); // cmp byte [rax + address], 0
+    return jcc(cc_ne);
+}
+
+void jit::set_cc(int reg)
+{
+    alu_rr32(0x89, rsi, reg);
+}
+
+size_t jit::jcc(uint8_t cc)
+{
+    emit8(0x0F);
+    emit8(0x80 | cc);
+    emit32(0);
+    return cursor_ - code_;
+}
+
+size_t jit::jmp()
+{
+    emit8(0xE9);
+    emit32(0);
+    return cursor_ - code_;
+}
+
+void jit::patch(size_t at, const uint8_t *target)
+{
+    // at is the offset just past a rel32 operand
+    int32_t rel = static_cast<int32_t>(target - (code_ + at));
+    memcpy(code_ + at - 4, &rel, sizeof(rel));
+}
+
+#endif // LC3_JIT
@@ -0,0 +1,109 @@
+#ifndef __jit_h__
+#define __jit_h__
+
+#include "config.h"
+#include "decode_cache.h"
+
+#ifdef LC3_JIT
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+// State shared between the vm and compiled code. R0-R7 live in host
+// registers r8-r15 while a block runs. The condition codes are the last
+// result value, kept that way by the vm too.
+struct jit_frame
+{
+    uint16_t *regs;
+    uint16_t *memory;
+    const uint8_t *code_map;
+    int64_t budget;
+    uint32_t cc;
+    const uint8_t *device_pages;
+    uint8_t *dirty_pages;
+    // every block starts by comparing the pending interrupt word with the
+    // bits the running priority masks
+    const std::atomic<uint32_t> *interrupts;
+    uint32_t level_mask;
+    // nullptr unless a breakpoint is armed; blocks end before breakpoints
+    const decode_cache *breakpoints;
+};
+
+// Translates basic blocks of LC-3 code to x86-64. Blocks end on control
+// flow and are chained directly to their successors. TRAP, RTI, the reserved
+// opcode, breakpoints, any access to a page with a memory mapped device and
+// any store to a word that has been compiled leave native code so the
+// interpreter can execute that one instruction. A block with an interrupt to take returns its
+// own pc before running anything.
+class jit
+{
+public:
+    // or'd into the pc returned by run() when the instruction at pc has to be
+    // executed by the interpreter
+    static const uint32_t interpret = 0x10000;
+    // or'd into the pc returned by run() when the block at pc needs more
+    // budget than frame.budget has left
+    static const uint32_t budget = 0x20000;
+
+    jit();
+    ~jit();
+
+    uint32_t run(jit_frame &frame, uint16_t pc);
+    bool compiled(uint16_t address) const;
+    const uint8_t *code_map() const;
+    void flush();
+
+private:
+    struct exit_stub
+    {
+        size_t jump;
+        uint32_t target;
+        bool chain;
+        int executed;   // instructions of the block that ran before this exit,
+                        // -1 if the budget has not been taken yet
+    };
+
+    uint8_t *compile(const jit_frame &frame, uint16_t pc);
+    void emit_exits(std::vector<exit_stub> &exits, int count);
+    void link(uint16_t pc, uint8_t *block);
+
+    void emit8(uint8_t value);
+    void emit16(uint16_t value);
+    void emit32(uint32_t value);
+    void rex(bool wide, int reg, int rm);
+    void alu_rr16(uint8_t op, int dst, int src);
+    void alu_rr32(uint8_t op, int dst, int src);
+    void alu_ri16(uint8_t ext, int dst, uint16_t imm);
+    void mov_ri32(int dst, uint32_t imm);
+    void not16(int dst);
+    void load_abs(int dst, uint16_t address);
+    void load_rcx(int dst);
+    void store_abs(int src, uint16_t address);
+    void store_rcx(int src);
+    void address_rcx(int base, uint16_t offset);
+    size_t check_device_rcx();
+    size_t check_code_rcx();
+    size_t check_code_abs(uint16_t address);
+    void set_cc(int reg);
+    size_t jcc(uint8_t cc);
+    size_t jmp();
+    void patch(size_t at, const uint8_t *target);
+
+private:
+    uint8_t *code_;
+    uint8_t *cursor_;
+    uint8_t *end_;
+    uint8_t *blocks_start_;
+    uint8_t *exit_;
+    uint32_t (*enter_)(jit_frame *, const uint8_t *);
+    std::vector<uint8_t *> blocks_;
+    std::vector<uint8_t> code_map_;
+    std::unordered_map<uint16_t, std::vector<uint8_t *>> links_;
+};
+
+#endif // LC3_JIT
+
+#endif // __jit_h__
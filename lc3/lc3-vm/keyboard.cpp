@@ -0,0 +1,81 @@
+#include "keyboard.h"
+
+void keyboard::attach(input_source *source)
+{
+    source_ = source;
+    if (source_)
+    {
+        source_->set_listener([this] { arrived(); });
+    }
+}
+
+void keyboard::connect(interrupt_controller *interrupts)
+{
+    interrupts_ = interrupts;
+}
+
+uint16_t keyboard::latch() const
+{
+    return data_;
+}
+
+void keyboard::set_latch(uint16_t key)
+{
+    data_ = key;
+}
+
+bool keyboard::interrupts_enabled() const
+{
+    return enabled_;
+}
+
+void keyboard::enable_interrupts(bool enable)
+{
+    enabled_ = enable;
+}
+
+uint16_t keyboard::read(uint16_t address)
+{
+    if (address == mmaps::kbsr)
+    {
+        uint16_t status = enabled_ ? (1 << 14) : 0;
+        return source_ && source_->ready() ? status | (1 << 15) : status;
+    }
+    if (address == mmaps::kbdr)
+    {
+        uint16_t key;
+        if (source_ && source_->poll(key))
+        {
+            data_ = key & 0x00FF;
+            // the line stays up while keys are waiting
+            if (source_->ready())
+            {
+                arrived();
+            }
+        }
+        return data_;
+    }
+    return 0;
+}
+
+void keyboard::write(uint16_t address, uint16_t value)
+{
+    if (address != mmaps::kbsr)
+    {
+        return;
+    }
+    enabled_ = (value & (1 << 14)) != 0;
+    // a key that is already waiting interrupts as soon as it is enabled
+    if (enabled_ && source_ && source_->ready())
+    {
+        arrived();
+    }
+}
+
+void keyboard::arrived()
+{
+    if (enabled_ && interrupts_)
+    {
+        interrupts_->raise(vector, priority);
+    }
+}
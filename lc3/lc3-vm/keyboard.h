@@ -0,0 +1,41 @@
+#ifndef __keyboard_h__
+#define __keyboard_h__
+
+#include "input.h"
+#include "interrupts.h"
+#include "memory.h"
+
+#include <atomic>
+
+// Keyboard behind kbsr/kbdr. The ready bit is a check of the input ring,
+// reading kbdr takes the key. With the interrupt enable bit (14) of kbsr
+// set, every key that arrives raises x80 at PL4.
+class keyboard : public device
+{
+public:
+    static const uint8_t vector = 0x80;
+    static const int priority = 4;
+
+    void attach(input_source *source);
+    void connect(interrupt_controller *interrupts);
+    // the last key read from kbdr and the interrupt enable, saved with vm
+    // snapshots
+    uint16_t latch() const;
+    void set_latch(uint16_t key);
+    bool interrupts_enabled() const;
+    void enable_interrupts(bool enable);
+
+    uint16_t read(uint16_t address) override;
+    void write(uint16_t address, uint16_t value) override;
+
+private:
+    void arrived();
+
+private:
+    input_source *source_ = nullptr;
+    interrupt_controller *interrupts_ = nullptr;
+    uint16_t data_ = 0;
+    std::atomic<bool> enabled_ = { false };
+};
+
+#endif // __keyboard_h__
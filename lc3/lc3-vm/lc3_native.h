@@ -0,0 +1,63 @@
+#ifndef __lc3_native_h__
+#define __lc3_native_h__
+
+/*
+    Native extension ABI of lc3-vm. A native extension is a shared library
+    that exports lc3_native_version() and lc3_execute(), and optionally
+    lc3_fire_interrupt(). Where the LC3Extension.h entry points go through a
+    callback for every register and memory word, these get pointers to the
+    registers and memory of the vm.
+
+    lc3_execute() runs for every reserved opcode (xD000-xDFFF) with PC
+    already past the instruction. lc3_fire_interrupt() is polled while no
+    interrupt handler is running, every few thousand instructions rather than
+    every instruction; it returns a vector from x80 to xFF or -1.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+#define LC3_NATIVE_EXTERN extern "C"
+#else
+#define LC3_NATIVE_EXTERN
+#endif
+
+#ifdef _WIN32
+#define LC3_NATIVE_API LC3_NATIVE_EXTERN __declspec(dllexport)
+#else
+#define LC3_NATIVE_API LC3_NATIVE_EXTERN __attribute__((visibility("default")))
+#endif
+
+#define LC3_NATIVE_VERSION 1
+
+/* indexes into lc3_context.regs */
+#define LC3_R0 0
+#define LC3_R7 7
+#define LC3_PC 8
+#define LC3_CC 9
+
+/* condition code bits in regs[LC3_CC], exactly one is set */
+#define LC3_CC_P 1
+#define LC3_CC_Z 2
+#define LC3_CC_N 4
+
+typedef struct lc3_context
+{
+    uint16_t *regs;
+    /* all 64K words. Memory mapped device registers are not in here; reads
+       see plain RAM and writes do not reach the device. */
+    uint16_t *memory;
+    uint16_t instruction;
+    /* report every range written through memory, once per range and before
+       returning, so the vm drops code it compiled from those words */
+    void (*written)(struct lc3_context *ctx, uint16_t address, uint32_t count);
+    void *host;
+} lc3_context;
+
+#ifndef LC3_NATIVE_HOST
+LC3_NATIVE_API int lc3_native_version(void);
+LC3_NATIVE_API void lc3_execute(lc3_context *ctx);
+LC3_NATIVE_API int lc3_fire_interrupt(const lc3_context *ctx);
+#endif
+
+#endif /* __lc3_native_h__ */
@@ -1,12 +1,169 @@
 
 #include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "replay.h"
 #include "vm.h"
 
 int main(int argc, const char **argv)
 {
-    std::ifstream obj_s("2048.obj", std::ios::binary);
-    vm machine;
-    machine.load(obj_s);
+    // lc3-vm [--profile report.txt] [--trace trace.bin] [--ext extension]
+    //        [--fuse all|none|add_br,...] [--record keys.log | --replay keys.log]
+    //        program.obj [more.obj...]|program.asm
+    // every object file is one segment of the program, the first is the entry;
+    // a source file is assembled first and its labels name the profile; a
+    // replayed session takes its keys from the log and not the console;
+    // --fuse picks the sequences the interpreter fuses, a profile report
+    // lists the ones worth it
+    const char *report = nullptr;
+    const char *trace = nullptr;
+    const char *record = nullptr;
+    const char *replay = nullptr;
+    extension ext;
+    bool extended = false;
+    object_set objects;
+    assembly source;
+    bool assembled = false;
+    fusion_set fusions = all_fusions();
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--profile" && i + 1 < argc)
+        {
+            report = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            trace = argv[++i];
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            record = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replay = argv[++i];
+        }
+        else if (arg == "--fuse" && i + 1 < argc)
+        {
+            if (!parse_fusions(argv[++i], fusions))
+            {
+                std::cerr << "unknown fusion in " << argv[i] << ", known are " << fusion_names(all_fusions()) << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--ext" && i + 1 < argc)
+        {
+            if (!ext.open(argv[++i]))
+            {
+                std::cerr << ext.error() << std::endl;
+                return 1;
+            }
+            extended = true;
+        }
+        else if (arg.size() > 4 && arg.compare(arg.size() - 4, 4, ".asm") == 0)
+        {
+            std::ifstream in(argv[i]);
+            std::stringstream text;
+            text << in.rdbuf();
+            if (!in || assembled || !objects.segments().empty())
+            {
+                std::cerr << (in ? "a source file is the whole program" : "cannot read " + arg) << std::endl;
+                return 1;
+            }
+            if (!assemble(text.str(), source))
+            {
+                for (auto &e : source.errors)
+                {
+                    std::cerr << arg << "(" << e.line << "): " << e.message << std::endl;
+                }
+                return 1;
+            }
+            assembled = true;
+        }
+        else if (assembled || !objects.add(argv[i]))
+        {
+            std::cerr << (assembled ? "a source file is the whole program" : objects.error()) << std::endl;
+            return 1;
+        }
+    }
+    if (!assembled && objects.segments().empty() && !objects.add("2048.obj"))
+    {
+        std::cerr << objects.error() << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<input_source> input;
+    std::ofstream log;
+    if (replay)
+    {
+        std::vector<input_event> events;
+        std::ifstream in(replay);
+        if (!in || !read_input_log(in, events))
+        {
+            std::cerr << "cannot read input log " << replay << std::endl;
+            return 1;
+        }
+        input.reset(new replayed_input(std::move(events)));
+    }
+    else if (record)
+    {
+        log.open(record);
+        if (!log)
+        {
+            std::cerr << "cannot create " << record << std::endl;
+            return 1;
+        }
+        input.reset(new recording_input(std::unique_ptr<input_source>(new console_input()), log));
+    }
+    else
+    {
+        input.reset(new console_input());
+    }
+
+    vm machine(std::move(input), std::unique_ptr<output_buffer>(new output_buffer(
+        std::unique_ptr<output_sink>(new console_sink()), 4096, std::chrono::milliseconds(50))));
+    machine.set_fusions(fusions);
+    if (assembled)
+    {
+        machine.load(source);
+        machine.set_entry(source.entry());
+    }
+    else
+    {
+        machine.load(objects);
+        machine.set_entry(objects.entry());
+    }
+    if (extended)
+    {
+        machine.set_extension(&ext);
+    }
+    profiler prof;
+    if (report)
+    {
+        prof.set_symbols(&source.symbols);
+        machine.set_profiler(&prof);
+    }
+    trace_recorder recorder;
+    if (trace)
+    {
+        if (!recorder.stream(trace))
+        {
+            std::cerr << "cannot create " << trace << std::endl;
+            return 1;
+        }
+        machine.set_tracer(&recorder);
+    }
     machine.run();
+    recorder.finish();
 
-}
\ No newline at end of file
+    if (report)
+    {
+        // folded stacks go next to the report, for flamegraph.pl
+        std::ofstream out(report);
+        prof.report(out);
+        std::ofstream folded(std::string(report) + ".folded");
+        prof.folded(folded);
+    }
+}
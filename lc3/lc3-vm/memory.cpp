@@ -1,38 +1,213 @@
 #include "memory.h"
 
+#include "object.h"
+
+#include <algorithm>
+#include <new>
+#include <string.h>
+
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
-#include <conio.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    const size_t memory_size = 0x10000 * sizeof(uint16_t);
+}
+
+memory::memory()
+{
+#ifdef _WIN32
+    memory_ = static_cast<uint16_t *>(VirtualAlloc(nullptr, memory_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+    void *p = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memory_ = p == MAP_FAILED ? nullptr : static_cast<uint16_t *>(p);
+#endif
+    if (memory_ == nullptr)
+        throw std::bad_alloc();
+    base_ = std::make_shared<memory_image>();
+}
+
+memory::~memory()
+{
+#ifdef _WIN32
+    VirtualFree(memory_, 0, MEM_RELEASE);
+#else
+    munmap(memory_, memory_size);
+#endif
+}
+
+void memory::load(uint16_t origin, const uint16_t *words, size_t count)
+{
+    count = std::min<size_t>(count, 0x10000 - origin);
+    std::copy(words, words + count, memory_ + origin);
+    touch(origin, count);
+}
+
+void memory::load(uint16_t origin, const uint8_t *words, size_t count)
+{
+    count = std::min<size_t>(count, 0x10000 - origin);
+    swap_words(memory_ + origin, words, count);
+    touch(origin, count);
+}
+
+void memory::touch(uint16_t origin, size_t count)
+{
+    for (size_t page = origin >> page_bits; count > 0 && page <= (origin + count - 1) >> page_bits; ++page)
+    {
+        dirty_[page] = 1;
+    }
+}
+
+void memory::map(uint16_t first, uint16_t last, device *dev)
+{
+    mappings_.push_back({ first, last, dev });
+    update_device_pages();
+}
+
+void memory::unmap(device *dev)
+{
+    mappings_.erase(std::remove_if(mappings_.begin(), mappings_.end(),
+        [dev](const mapping &m) { return m.dev == dev; }), mappings_.end());
+    update_device_pages();
+}
+
+void memory::set_watcher(watcher *w)
+{
+    watcher_ = w;
+}
+
+void memory::watch(uint16_t first, uint16_t last)
+{
+    for (size_t page = first >> page_bits; page <= static_cast<size_t>(last >> page_bits); ++page)
+    {
+        watched_[page] = 1;
+    }
+    update_device_pages();
+}
+
+void memory::unwatch()
+{
+    watched_.fill(0);
+    update_device_pages();
+}
 
-uint16_t check_key()
+void memory::update_device_pages()
 {
-    HANDLE csl = GetStdHandle(STD_INPUT_HANDLE);
-    return WaitForSingleObject(csl, 1000) == WAIT_OBJECT_0 && _kbhit();
+    device_pages_ = watched_;
+    for (auto &m : mappings_)
+    {
+        for (size_t page = m.first >> page_bits; page <= static_cast<size_t>(m.last >> page_bits); ++page)
+        {
+            device_pages_[page] = 1;
+        }
+    }
+}
+
+const uint8_t *memory::device_pages() const
+{
+    return device_pages_.data();
+}
+
+uint16_t *memory::get()
+{
+    return memory_;
 }
 
-uint16_t memory::read(uint16_t addr)
+uint8_t *memory::dirty_pages()
 {
-    if (addr == mmaps::kbsr)
+    return dirty_.data();
+}
+
+std::shared_ptr<const memory_image> memory::capture()
+{
+    if (std::find(dirty_.begin(), dirty_.end(), 1) == dirty_.end())
+    {
+        return base_;
+    }
+
+    auto image = std::make_shared<memory_image>(*base_);
+    for (size_t page = 0; page < page_count; ++page)
     {
-        if (check_key())
+        if (!dirty_[page])
+            continue;
+        dirty_[page] = 0;
+        auto words = memory_ + (page << page_bits);
+        auto end = words + (1 << page_bits);
+        if (std::all_of(words, end, [](uint16_t w) { return w == 0; }))
         {
-            memory_[mmaps::kbsr] = (1 << 15);
-            memory_[mmaps::kbdr] = _getch();
+            image->pages[page].reset();
         }
         else
         {
-            memory_[mmaps::kbsr] = 0;
+            auto copy = std::make_shared<memory_image::page>();
+            std::copy(words, end, copy->begin());
+            image->pages[page] = copy;
         }
     }
-    return memory_[addr];
+    base_ = image;
+    return base_;
 }
 
-void memory::write(uint16_t addr, uint16_t value)
+std::vector<size_t> memory::restore(const std::shared_ptr<const memory_image> &image)
 {
-    memory_[addr] = value;
+    std::vector<size_t> changed;
+    for (size_t page = 0; page < page_count; ++page)
+    {
+        auto &from = image->pages[page];
+        if (!dirty_[page] && from == base_->pages[page])
+            continue;
+        dirty_[page] = 0;
+        auto words = memory_ + (page << page_bits);
+        if (from)
+            memcpy(words, from->data(), sizeof(memory_image::page));
+        else
+            memset(words, 0, sizeof(memory_image::page));
+        changed.push_back(page);
+    }
+    base_ = image;
+    return changed;
 }
 
-uint16_t *memory::get()
+device *memory::find(uint16_t address)
+{
+    for (auto &m : mappings_)
+    {
+        if (address >= m.first && address <= m.last)
+        {
+            return m.dev;
+        }
+    }
+    return nullptr;
+}
+
+uint16_t memory::device_read(uint16_t address)
 {
-    return memory_.data();
+    if (watched_[address >> page_bits] && watcher_)
+    {
+        watcher_->accessed(address, false);
+    }
+    auto dev = find(address);
+    return dev ? dev->read(address) : memory_[address];
+}
+
+void memory::device_write(uint16_t address, uint16_t value)
+{
+    if (watched_[address >> page_bits] && watcher_)
+    {
+        watcher_->accessed(address, true);
+    }
+    auto dev = find(address);
+    if (dev)
+    {
+        dev->write(address, value);
+    }
+    else
+    {
+        memory_[address] = value;
+        dirty_[address >> page_bits] = 1;
+    }
 }
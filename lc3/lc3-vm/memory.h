@@ -2,8 +2,10 @@
 #define __memory_h__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <array>
-#include <limits>
+#include <memory>
+#include <vector>
 
 enum mmaps
 {
@@ -11,15 +13,112 @@ enum mmaps
     kbdr = 0xFE02
 };
 
+// A memory mapped device, registered for an address range with memory::map().
+class device
+{
+public:
+    virtual ~device() {}
+    virtual uint16_t read(uint16_t address) = 0;
+    virtual void write(uint16_t address, uint16_t value) = 0;
+};
+
+// Told about every access to a watched range, see memory::watch().
+class watcher
+{
+public:
+    virtual ~watcher() {}
+    virtual void accessed(uint16_t address, bool write) = 0;
+};
+
+struct memory_image;
+
 class memory
 {
 public:
-    uint16_t read(uint16_t address);
-    void write(uint16_t address, uint16_t value);
+    static const int page_bits = 8;
+    static const size_t page_count = 0x10000 >> page_bits;
+
+    memory();
+    ~memory();
+    memory(const memory &) = delete;
+    memory &operator=(const memory &) = delete;
+
+    // plain RAM only pays for the page flag, pages with a device mapped on
+    // them go through the slow path
+    uint16_t read(uint16_t address)
+    {
+        if (device_pages_[address >> page_bits])
+            return device_read(address);
+        return memory_[address];
+    }
+
+    void write(uint16_t address, uint16_t value)
+    {
+        if (device_pages_[address >> page_bits])
+        {
+            device_write(address, value);
+        }
+        else
+        {
+            memory_[address] = value;
+            dirty_[address >> page_bits] = 1;
+        }
+    }
+
+    void load(uint16_t origin, const uint16_t *words, size_t count);
+    // big endian words straight from an object file
+    void load(uint16_t origin, const uint8_t *words, size_t count);
+    void map(uint16_t first, uint16_t last, device *dev);
+    void unmap(device *dev);
+    // Watched pages take the slow path like device pages; every access to
+    // one goes to the watcher, which picks out the words it cares about.
+    void set_watcher(watcher *w);
+    void watch(uint16_t first, uint16_t last);
+    void unwatch();
+    const uint8_t *device_pages() const;
     uint16_t *get();
 
+    // Whoever writes through get() has to set the page in dirty_pages().
+    // capture() only copies pages dirtied since the last capture or
+    // restore, restore() only copies pages that differ and returns them.
+    uint8_t *dirty_pages();
+    std::shared_ptr<const memory_image> capture();
+    std::vector<size_t> restore(const std::shared_ptr<const memory_image> &image);
+
+private:
+    struct mapping
+    {
+        uint16_t first;
+        uint16_t last;
+        device *dev;
+    };
+
+    uint16_t device_read(uint16_t address);
+    void device_write(uint16_t address, uint16_t value);
+    device *find(uint16_t address);
+    void touch(uint16_t origin, size_t count);
+    void update_device_pages();
+
 private:
-    std::array<uint16_t, std::numeric_limits<uint16_t>::max()> memory_ = { 0 };
+    // all 128KB are committed up front, but as demand-zero pages the os only
+    // backs the ones a program touches
+    uint16_t *memory_;
+    std::array<uint8_t, page_count> device_pages_ = { 0 };
+    std::array<uint8_t, page_count> dirty_ = { 0 };
+    std::array<uint8_t, page_count> watched_ = { 0 };
+    watcher *watcher_ = nullptr;
+    std::shared_ptr<const memory_image> base_;     // what the clean pages hold
+    std::vector<mapping> mappings_;
+};
+
+// Memory contents captured by memory::capture(). Pages are never modified
+// once captured so images share every page they have in common; pages that
+// are all zero are not stored.
+struct memory_image
+{
+    typedef std::array<uint16_t, 1 << memory::page_bits> page;
+
+    std::array<std::shared_ptr<const page>, memory::page_count> pages;
 };
 
-#endif // __memory_h__
\ No newline at end of file
+#endif // __memory_h__
@@ -0,0 +1,215 @@
+#include "object.h"
+
+#include "config.h"
+
+#ifdef LC3_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef LC3_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+
+bool read_object(std::istream &stream, object_image &image)
+{
+    uint8_t origin[2];
+    if (!stream.read(reinterpret_cast<char *>(origin), sizeof(origin)))
+    {
+        return false;
+    }
+    swap_words(&image.origin, origin, 1);
+
+    size_t max_words = 0x10000 - image.origin;
+    std::vector<uint8_t> bytes(max_words * 2);
+    stream.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+    image.words.resize(static_cast<size_t>(stream.gcount()) / 2);
+    swap_words(image.words.data(), bytes.data(), image.words.size());
+    return true;
+}
+
+void swap_words(uint16_t *dest, const uint8_t *source, size_t count)
+{
+    size_t i = 0;
+#ifdef LC3_AVX2
+    for (; i + 16 <= count; i += 16)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + i * 2));
+        v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), v);
+    }
+#endif
+#ifdef LC3_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i * 2));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), v);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        dest[i] = static_cast<uint16_t>((source[i * 2] << 8) | source[i * 2 + 1]);
+    }
+}
+
+object_file::object_file()
+    : segment_({ 0, 0, nullptr }), data_(nullptr), size_(0)
+#ifdef _WIN32
+    , file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+#endif
+{
+}
+
+object_file::~object_file()
+{
+    close();
+}
+
+bool object_file::open(const char *path)
+{
+    close();
+    error_.clear();
+#ifdef _WIN32
+    file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size))
+    {
+        error_ = std::string("cannot open ") + path;
+        return false;
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        error_ = std::string("cannot open ") + path;
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+#endif
+
+    // validate the header before paying for a mapping
+    char problem[64] = "";
+    if (size_ < 2)
+        snprintf(problem, sizeof(problem), "no origin");
+    else if (size_ % 2 != 0)
+        snprintf(problem, sizeof(problem), "odd size");
+    else if (size_ == 2)
+        snprintf(problem, sizeof(problem), "no words after the origin");
+
+    if (problem[0] == 0)
+    {
+#ifdef _WIN32
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_ != nullptr)
+            data_ = static_cast<const uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+#else
+        void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        data_ = p == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(p);
+#endif
+        if (data_ == nullptr)
+            snprintf(problem, sizeof(problem), "cannot map");
+    }
+#ifndef _WIN32
+    ::close(fd);
+#endif
+
+    if (problem[0] == 0)
+    {
+        uint16_t origin;
+        swap_words(&origin, data_, 1);
+        segment_ = { origin, size_ / 2 - 1, data_ + 2 };
+        if (origin + segment_.count > 0x10000)
+            snprintf(problem, sizeof(problem), "x%04X + %zu words runs past xFFFF", origin, segment_.count);
+    }
+    if (problem[0] != 0)
+    {
+        error_ = std::string(path) + ": " + problem;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void object_file::close()
+{
+#ifdef _WIN32
+    if (data_ != nullptr)
+        UnmapViewOfFile(data_);
+    if (mapping_ != nullptr)
+        CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE)
+        CloseHandle(file_);
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_ != nullptr)
+        munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    segment_ = { 0, 0, nullptr };
+}
+
+const object_segment &object_file::segment() const
+{
+    return segment_;
+}
+
+const std::string &object_file::error() const
+{
+    return error_;
+}
+
+bool object_set::add(const char *path)
+{
+    std::unique_ptr<object_file> file(new object_file());
+    if (!file->open(path))
+    {
+        error_ = file->error();
+        return false;
+    }
+    auto &s = file->segment();
+    for (auto &other : segments_)
+    {
+        if (s.origin < other.origin + other.count && other.origin < s.origin + s.count)
+        {
+            char problem[64];
+            snprintf(problem, sizeof(problem), ": overlaps the segment at x%04X", other.origin);
+            error_ = path + std::string(problem);
+            return false;
+        }
+    }
+    segments_.push_back(s);
+    files_.push_back(std::move(file));
+    return true;
+}
+
+const std::vector<object_segment> &object_set::segments() const
+{
+    return segments_;
+}
+
+uint16_t object_set::entry() const
+{
+    return segments_.empty() ? 0x3000 : segments_.front().origin;
+}
+
+const std::string &object_set::error() const
+{
+    return error_;
+}
@@ -0,0 +1,78 @@
+#ifndef __object_h__
+#define __object_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// An LC-3 object file: a big endian origin word followed by the big endian
+// words to place there.
+struct object_image
+{
+    uint16_t origin;
+    std::vector<uint16_t> words;
+};
+
+bool read_object(std::istream &stream, object_image &image);
+
+// Converts count big endian words to host order, with SSE2/AVX2 when the
+// build allows it.
+void swap_words(uint16_t *dest, const uint8_t *source, size_t count);
+
+// The words of one object file as they are on disk, still big endian.
+struct object_segment
+{
+    uint16_t origin;
+    size_t count;
+    const uint8_t *data;
+};
+
+// An object file mapped read only. The segment points into the mapping,
+// nothing is copied until the segment is loaded into a vm.
+class object_file
+{
+public:
+    object_file();
+    ~object_file();
+    object_file(const object_file &) = delete;
+    object_file &operator=(const object_file &) = delete;
+
+    // maps the file and checks the header, error() says why it failed
+    bool open(const char *path);
+    const object_segment &segment() const;
+    const std::string &error() const;
+
+private:
+    void close();
+
+private:
+    object_segment segment_;
+    std::string error_;
+    const uint8_t *data_;
+    size_t size_;
+#ifdef _WIN32
+    void *file_;
+    void *mapping_;
+#endif
+};
+
+// The object files that make up one program. Segments may come from any
+// number of files but must not overlap; the first one added is the entry.
+class object_set
+{
+public:
+    bool add(const char *path);
+    const std::vector<object_segment> &segments() const;
+    uint16_t entry() const;
+    const std::string &error() const;
+
+private:
+    std::vector<std::unique_ptr<object_file>> files_;
+    std::vector<object_segment> segments_;
+    std::string error_;
+};
+
+#endif // __object_h__
@@ -18,7 +18,10 @@ enum class op_codes
     op_jmp,
     op_res,
     op_lea,
-    op_trap
+    op_trap,
+    // not an LC-3 opcode: the decode cache hands it out in place of an
+    // instruction with a breakpoint on it
+    op_break
 };
 
 #endif 
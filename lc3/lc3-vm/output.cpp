@@ -0,0 +1,123 @@
+#include "output.h"
+
+#include "console.h"
+
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+
+void console_sink::write(const char *data, size_t size)
+{
+    console_write(data, size);
+}
+
+file_sink::file_sink(const char *path)
+    : file_(nullptr)
+{
+#ifdef _WIN32
+    fopen_s(&file_, path, "wb");
+#else
+    file_ = fopen(path, "wb");
+#endif
+    if (file_ == nullptr)
+        throw std::runtime_error(std::string("failed to open ") + path);
+}
+
+file_sink::~file_sink()
+{
+    fclose(file_);
+}
+
+void file_sink::write(const char *data, size_t size)
+{
+    fwrite(data, 1, size, file_);
+}
+
+void capture_sink::write(const char *data, size_t size)
+{
+    data_.append(data, size);
+}
+
+const std::string &capture_sink::str() const
+{
+    return data_;
+}
+
+void capture_sink::clear()
+{
+    data_.clear();
+}
+
+output_buffer::output_buffer(std::unique_ptr<output_sink> sink, size_t capacity, std::chrono::milliseconds interval)
+    : sink_(std::move(sink)), capacity_(capacity), timed_(interval.count() > 0)
+{
+    buffer_.reserve(capacity_);
+    if (timed_)
+    {
+        timer_ = std::thread(&output_buffer::timer, this, interval);
+    }
+}
+
+output_buffer::~output_buffer()
+{
+    if (timed_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopping_ = true;
+        }
+        stop_.notify_one();
+        timer_.join();
+    }
+    flush_locked();
+}
+
+void output_buffer::put(char c)
+{
+    // without a timer thread nobody else touches the buffer
+    std::unique_lock<std::mutex> lock(lock_, std::defer_lock);
+    if (timed_)
+        lock.lock();
+    buffer_.push_back(c);
+    if (buffer_.size() >= capacity_)
+        flush_locked();
+}
+
+void output_buffer::put(const char *str)
+{
+    while (*str)
+    {
+        put(*str++);
+    }
+}
+
+void output_buffer::flush()
+{
+    std::unique_lock<std::mutex> lock(lock_, std::defer_lock);
+    if (timed_)
+        lock.lock();
+    flush_locked();
+}
+
+output_sink &output_buffer::sink()
+{
+    return *sink_;
+}
+
+void output_buffer::flush_locked()
+{
+    if (!buffer_.empty())
+    {
+        sink_->write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    }
+}
+
+void output_buffer::timer(std::chrono::milliseconds interval)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!stop_.wait_for(lock, interval, [this] { return stopping_; }))
+    {
+        flush_locked();
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef __output_h__
+#define __output_h__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Where OUT/PUTS/PUTSP end up once the output buffer is flushed.
+class output_sink
+{
+public:
+    virtual ~output_sink() {}
+    virtual void write(const char *data, size_t size) = 0;
+};
+
+class console_sink : public output_sink
+{
+public:
+    void write(const char *data, size_t size) override;
+};
+
+class file_sink : public output_sink
+{
+public:
+    explicit file_sink(const char *path);
+    ~file_sink();
+    void write(const char *data, size_t size) override;
+
+private:
+    FILE *file_;
+};
+
+// Keeps everything in memory, for headless runs.
+class capture_sink : public output_sink
+{
+public:
+    void write(const char *data, size_t size) override;
+    const std::string &str() const;
+    void clear();
+
+private:
+    std::string data_;
+};
+
+// Buffers trap output in front of a sink. The vm flushes on HALT and before
+// waiting for input; the buffer also flushes when full and, if an interval
+// is given, from a timer thread so slow trickles of output still show up.
+class output_buffer
+{
+public:
+    explicit output_buffer(std::unique_ptr<output_sink> sink, size_t capacity = 4096,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(0));
+    ~output_buffer();
+
+    void put(char c);
+    void put(const char *str);
+    void flush();
+    output_sink &sink();
+
+private:
+    void flush_locked();
+    void timer(std::chrono::milliseconds interval);
+
+private:
+    std::unique_ptr<output_sink> sink_;
+    std::vector<char> buffer_;
+    size_t capacity_;
+    bool timed_;
+    bool stopping_ = false;
+    std::mutex lock_;
+    std::condition_variable stop_;
+    std::thread timer_;
+};
+
+#endif // __output_h__
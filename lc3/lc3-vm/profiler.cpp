@@ -0,0 +1,263 @@
+#include "profiler.h"
+
+#include "disasm.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+
+namespace
+{
+    std::string hex(uint16_t address)
+    {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "x%04X", address);
+        return buf;
+    }
+
+    std::string percent(uint64_t part, uint64_t whole)
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%5.1f%%", whole ? 100.0 * part / whole : 0.0);
+        return buf;
+    }
+
+    template <typename T>
+    std::vector<std::pair<T, uint64_t>> hottest(std::vector<std::pair<T, uint64_t>> items, size_t top)
+    {
+        auto n = std::min(top, items.size());
+        std::partial_sort(items.begin(), items.begin() + n, items.end(),
+            [](const std::pair<T, uint64_t> &a, const std::pair<T, uint64_t> &b) { return a.second > b.second; });
+        items.resize(n);
+        return items;
+    }
+}
+
+profiler::profiler()
+{
+    begin(0x3000);
+}
+
+void profiler::set_symbols(const symbol_table *symbols)
+{
+    symbols_ = symbols;
+}
+
+std::string profiler::where(uint16_t address) const
+{
+    return symbols_ ? symbols_->describe(address) : hex(address);
+}
+
+void profiler::begin(uint16_t entry)
+{
+    counts_.assign(0x10000, 0);
+    ops_.fill(0);
+    loops_.clear();
+    edges_.clear();
+    nodes_.assign(1, { 0, entry });
+    self_.assign(1, 0);
+    children_.clear();
+    stack_.clear();
+    frame_ = 0;
+    fused_.fill(0);
+    run_ = 0;
+    follows_ = -1;
+}
+
+uint64_t profiler::total() const
+{
+    uint64_t sum = 0;
+    for (auto c : ops_)
+    {
+        sum += c;
+    }
+    return sum;
+}
+
+uint64_t profiler::count(uint16_t address) const
+{
+    return counts_[address];
+}
+
+uint64_t profiler::count(op_codes op) const
+{
+    return ops_[static_cast<int>(op)];
+}
+
+uint64_t profiler::count(fusion f) const
+{
+    return fused_[static_cast<int>(f)];
+}
+
+fusion_set profiler::fusions(double share) const
+{
+    fusion_set worth;
+    auto all = total();
+    for (size_t f = 1; f < fused_.size(); ++f)
+    {
+        auto covered = fused_[f] * fusion_length(static_cast<fusion>(f));
+        if (fused_[f] && covered >= share * all)
+            worth.set(f);
+    }
+    return worth;
+}
+
+void profiler::sequence()
+{
+    for (size_t f = 1; f < fused_.size(); ++f)
+    {
+        auto kind = static_cast<fusion>(f);
+        auto n = fusion_length(kind);
+        if (n <= static_cast<size_t>(run_) && fuses(kind, &recent_[recent_.size() - n]))
+            ++fused_[f];
+    }
+}
+
+void profiler::call(uint16_t site, uint16_t target)
+{
+    ++edges_[std::make_pair(nodes_[frame_].function, target)];
+    if (stack_.size() == max_depth)
+    {
+        // runaway recursion or JSR used as a jump, stop growing the tree
+        return;
+    }
+    stack_.push_back({ frame_, static_cast<uint16_t>(site + 1) });
+
+    auto key = std::make_pair(frame_, target);
+    auto it = children_.find(key);
+    if (it == children_.end())
+    {
+        it = children_.emplace(key, static_cast<uint32_t>(nodes_.size())).first;
+        nodes_.push_back({ frame_, target });
+        self_.push_back(0);
+    }
+    frame_ = it->second;
+}
+
+void profiler::ret(uint16_t target)
+{
+    // unwind to the frame this returns to, a RET that matches no call is
+    // just a jump
+    for (auto i = stack_.size(); i > 0; --i)
+    {
+        if (stack_[i - 1].resume == target)
+        {
+            frame_ = stack_[i - 1].caller;
+            stack_.resize(i - 1);
+            return;
+        }
+    }
+}
+
+void profiler::report(std::ostream &out, size_t top) const
+{
+    auto all = total();
+    out << "instructions " << all << "\n";
+
+    out << "\nopcodes\n";
+    std::vector<std::pair<int, uint64_t>> ops;
+    for (int i = 0; i < 16; ++i)
+    {
+        if (ops_[i])
+            ops.emplace_back(i, ops_[i]);
+    }
+    for (auto &o : hottest(ops, ops.size()))
+    {
+        char line[64];
+        snprintf(line, sizeof(line), "  %-6s %12llu %s\n", op_name(static_cast<op_codes>(o.first)),
+            static_cast<unsigned long long>(o.second), percent(o.second, all).c_str());
+        out << line;
+    }
+
+    // the instructions each sequence covered, overlapping ones count for each
+    out << "\nfused sequences\n";
+    std::vector<std::pair<int, uint64_t>> sequences;
+    for (size_t f = 1; f < fused_.size(); ++f)
+    {
+        if (fused_[f])
+            sequences.emplace_back(static_cast<int>(f), fused_[f] * fusion_length(static_cast<fusion>(f)));
+    }
+    for (auto &q : hottest(sequences, sequences.size()))
+    {
+        char line[96];
+        snprintf(line, sizeof(line), "  %-12s %12llu times %12llu instructions %s\n", fusion_name(static_cast<fusion>(q.first)),
+            static_cast<unsigned long long>(fused_[q.first]), static_cast<unsigned long long>(q.second),
+            percent(q.second, all).c_str());
+        out << line;
+    }
+    out << "  worth fusing " << fusion_names(fusions()) << "\n";
+
+    out << "\ntop addresses\n";
+    std::vector<std::pair<uint16_t, uint64_t>> addresses;
+    for (size_t a = 0; a < counts_.size(); ++a)
+    {
+        if (counts_[a])
+            addresses.emplace_back(static_cast<uint16_t>(a), counts_[a]);
+    }
+    for (auto &a : hottest(addresses, top))
+    {
+        char line[160];
+        snprintf(line, sizeof(line), "  %-12s %12llu %s\n", where(a.first).c_str(),
+            static_cast<unsigned long long>(a.second), percent(a.second, all).c_str());
+        out << line;
+    }
+
+    // a loop is a taken backward branch, its body everything from the
+    // target up to the branch
+    out << "\nhot loops\n";
+    std::vector<std::pair<uint32_t, uint64_t>> loops;
+    for (auto &l : loops_)
+    {
+        uint64_t body = 0;
+        for (uint32_t a = l.first & 0xFFFF; a <= l.first >> 16; ++a)
+        {
+            body += counts_[a];
+        }
+        loops.emplace_back(l.first, body);
+    }
+    for (auto &l : hottest(loops, top))
+    {
+        char line[224];
+        snprintf(line, sizeof(line), "  %s-%s iterations %10llu instructions %12llu %s\n",
+            where(l.first & 0xFFFF).c_str(), where(l.first >> 16).c_str(),
+            static_cast<unsigned long long>(loops_.at(l.first)),
+            static_cast<unsigned long long>(l.second), percent(l.second, all).c_str());
+        out << line;
+    }
+
+    out << "\nfunctions (self)\n";
+    std::map<uint16_t, uint64_t> self;
+    for (size_t n = 0; n < nodes_.size(); ++n)
+    {
+        self[nodes_[n].function] += self_[n];
+    }
+    for (auto &f : hottest(std::vector<std::pair<uint16_t, uint64_t>>(self.begin(), self.end()), top))
+    {
+        char line[160];
+        snprintf(line, sizeof(line), "  %-12s %12llu %s\n", where(f.first).c_str(),
+            static_cast<unsigned long long>(f.second), percent(f.second, all).c_str());
+        out << line;
+    }
+
+    out << "\ncall graph\n";
+    for (auto &e : edges_)
+    {
+        out << "  " << where(e.first.first) << " -> " << where(e.first.second) << " calls " << e.second << "\n";
+    }
+}
+
+void profiler::folded(std::ostream &out) const
+{
+    for (size_t n = 0; n < nodes_.size(); ++n)
+    {
+        if (!self_[n])
+            continue;
+        std::string stack = where(nodes_[n].function);
+        for (auto p = n; p != 0;)
+        {
+            p = nodes_[p].parent;
+            stack = where(nodes_[p].function) + ";" + stack;
+        }
+        out << stack << " " << self_[n] << "\n";
+    }
+}
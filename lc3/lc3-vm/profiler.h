@@ -0,0 +1,108 @@
+#ifndef __profiler_h__
+#define __profiler_h__
+
+#include "assembler.h"
+#include "decode_cache.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Counts executions per address and per opcode, follows JSR/JSRR, TRAPs
+// through the vector table and RET to keep a call tree, and remembers taken
+// backward branches as loops. Attach one with vm::set_profiler(); while
+// attached the vm runs every instruction through the interpreter, without one
+// the engines are untouched.
+class profiler
+{
+public:
+    profiler();
+
+    // called by the vm once the instruction at pc has retired, next is the
+    // pc it left behind
+    void retired(uint16_t pc, const decoded &inst, uint16_t next)
+    {
+        ++counts_[pc];
+        ++ops_[static_cast<int>(inst.op)];
+        ++self_[frame_];
+        if (inst.op == op_codes::op_jsr || (inst.op == op_codes::op_trap && next != pc && next != static_cast<uint16_t>(pc + 1)))
+            call(pc, next);
+        else if (inst.op == op_codes::op_jmp && inst.sr1 == 7)
+            ret(next);
+        else if (next <= pc && (inst.op == op_codes::op_br || inst.op == op_codes::op_jmp))
+            ++loops_[(static_cast<uint32_t>(pc) << 16) | next];
+
+        // the last few instructions that ran one after another
+        run_ = pc == follows_ ? std::min(run_ + 1, 3) : 1;
+        recent_[0] = recent_[1];
+        recent_[1] = recent_[2];
+        recent_[2] = inst;
+        follows_ = next == static_cast<uint16_t>(pc + 1) ? next : -1;
+        if (run_ >= 2)
+            sequence();
+    }
+
+    // drops everything counted so far, entry names the root of the call tree
+    void begin(uint16_t entry);
+    // reports name addresses after these labels, nullptr goes back to hex
+    void set_symbols(const symbol_table *symbols);
+    uint64_t total() const;
+    uint64_t count(uint16_t address) const;
+    uint64_t count(op_codes op) const;
+    // times the sequence ran start to end without a jump into or out of
+    // it; overlapping sequences each count
+    uint64_t count(fusion f) const;
+    // the sequences that took at least share of all instructions, for
+    // vm::set_fusions()
+    fusion_set fusions(double share = 0.01) const;
+
+    // top addresses, opcode mix, fused sequences, hottest loops and the
+    // call graph
+    void report(std::ostream &out, size_t top = 20) const;
+    // one line per call stack, "x3000;x3100;x3180 count", as read by
+    // flamegraph.pl and speedscope
+    void folded(std::ostream &out) const;
+
+private:
+    struct node
+    {
+        uint32_t parent;
+        uint16_t function;
+    };
+
+    struct frame
+    {
+        uint32_t caller;    // node to go back to
+        uint16_t resume;    // where the matching RET returns
+    };
+
+    static const size_t max_depth = 1024;
+
+    void call(uint16_t site, uint16_t target);
+    void ret(uint16_t target);
+    void sequence();
+    std::string where(uint16_t address) const;
+
+private:
+    std::vector<uint64_t> counts_;
+    std::array<uint64_t, 16> ops_;
+    std::unordered_map<uint32_t, uint64_t> loops_;      // branch pc << 16 | target
+    std::map<std::pair<uint16_t, uint16_t>, uint64_t> edges_;   // caller, callee
+    // call tree, nodes_[0] is the root and every path from it is a stack
+    std::vector<node> nodes_;
+    std::vector<uint64_t> self_;
+    std::map<std::pair<uint32_t, uint16_t>, uint32_t> children_;
+    std::vector<frame> stack_;
+    uint32_t frame_;    // node of the running function
+    const symbol_table *symbols_ = nullptr;
+    std::array<uint64_t, static_cast<size_t>(fusion::count)> fused_;
+    std::array<decoded, 3> recent_;
+    int run_;           // how many of recent_, the newest last, ran in a row
+    int32_t follows_;   // the pc that continues the run
+};
+
+#endif // __profiler_h__
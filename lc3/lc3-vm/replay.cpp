@@ -0,0 +1,132 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <sstream>
+#include <string>
+
+bool read_input_log(std::istream &in, std::vector<input_event> &events)
+{
+    std::string line;
+    while (std::getline(in, line))
+    {
+        uint64_t count;
+        char x;
+        unsigned key;
+        if (line.empty())
+            continue;
+        std::istringstream fields(line);
+        if (!(fields >> count >> x >> std::hex >> key) || x != 'x' || key > 0xFFFF || !(fields >> std::ws).eof())
+            return false;
+        if (!events.empty() && count < events.back().count)
+            return false;
+        events.push_back({ count, static_cast<uint16_t>(key) });
+    }
+    return true;
+}
+
+void write_input_event(std::ostream &out, const input_event &e)
+{
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%llu x%04X\n", static_cast<unsigned long long>(e.count), e.key);
+    out << buf;
+}
+
+recording_input::recording_input(std::unique_ptr<input_source> live, std::ostream &log, uint64_t interval)
+    : live_(std::move(live)), log_(log), interval_(interval ? interval : 1)
+{
+}
+
+bool recording_input::ready()
+{
+    return !visible_.empty();
+}
+
+bool recording_input::poll(uint16_t &key)
+{
+    if (visible_.empty())
+        return false;
+    key = visible_.front();
+    visible_.pop_front();
+    return true;
+}
+
+bool recording_input::wait()
+{
+    return !visible_.empty() || live_->wait();
+}
+
+void recording_input::advance(uint64_t now)
+{
+    uint16_t key;
+    bool any = false;
+    while (live_->poll(key))
+    {
+        visible_.push_back(key);
+        write_input_event(log_, { now, key });
+        any = true;
+    }
+    if (any)
+    {
+        log_.flush();
+        arrived();
+    }
+}
+
+uint64_t recording_input::due(uint64_t now)
+{
+    return (now / interval_ + 1) * interval_;
+}
+
+replayed_input::replayed_input(std::vector<input_event> events)
+    : events_(std::move(events)), next_(0)
+{
+}
+
+void replayed_input::rewind()
+{
+    next_ = 0;
+    visible_.clear();
+}
+
+bool replayed_input::finished() const
+{
+    return next_ == events_.size() && visible_.empty();
+}
+
+bool replayed_input::ready()
+{
+    return !visible_.empty();
+}
+
+bool replayed_input::poll(uint16_t &key)
+{
+    if (visible_.empty())
+        return false;
+    key = visible_.front();
+    visible_.pop_front();
+    return true;
+}
+
+bool replayed_input::wait()
+{
+    return !visible_.empty();
+}
+
+void replayed_input::advance(uint64_t now)
+{
+    bool any = false;
+    for (; next_ < events_.size() && events_[next_].count <= now; ++next_)
+    {
+        visible_.push_back(events_[next_].key);
+        any = true;
+    }
+    if (any)
+    {
+        arrived();
+    }
+}
+
+uint64_t replayed_input::due(uint64_t now)
+{
+    return next_ < events_.size() ? events_[next_].count : std::numeric_limits<uint64_t>::max();
+}
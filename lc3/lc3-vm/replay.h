@@ -0,0 +1,72 @@
+#ifndef __replay_h__
+#define __replay_h__
+
+#include "input.h"
+
+#include <stdint.h>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// A key and the instruction count at which the program could first see it.
+struct input_event
+{
+    uint64_t count;
+    uint16_t key;
+};
+
+// Input logs are text, one "count key" line per event with the key in hex,
+// e.g. "48210 x0077".
+bool read_input_log(std::istream &in, std::vector<input_event> &events);
+void write_input_event(std::ostream &out, const input_event &e);
+
+// Records a session. Keys from the live source are held back until the vm
+// reaches the next multiple of interval instructions, or the next time it
+// blocks for input, and only become visible there; every key is logged with
+// that count, so replaying the log makes the same keys visible at the same
+// instructions.
+class recording_input : public input_source
+{
+public:
+    recording_input(std::unique_ptr<input_source> live, std::ostream &log, uint64_t interval = 1000);
+
+    bool ready() override;
+    bool poll(uint16_t &key) override;
+    bool wait() override;
+    void advance(uint64_t now) override;
+    uint64_t due(uint64_t now) override;
+
+private:
+    std::unique_ptr<input_source> live_;
+    std::ostream &log_;
+    uint64_t interval_;
+    std::deque<uint16_t> visible_;
+};
+
+// Plays a log back with no console: every key becomes visible at exactly the
+// count it was recorded at. Once the log is used up, or the program blocks
+// for a key the log does not have yet, wait() ends the run.
+class replayed_input : public input_source
+{
+public:
+    explicit replayed_input(std::vector<input_event> events);
+
+    // starts over, for a vm restored to the start of the session
+    void rewind();
+    bool finished() const;
+
+    bool ready() override;
+    bool poll(uint16_t &key) override;
+    bool wait() override;
+    void advance(uint64_t now) override;
+    uint64_t due(uint64_t now) override;
+
+private:
+    std::vector<input_event> events_;
+    size_t next_;
+    std::deque<uint16_t> visible_;
+};
+
+#endif // __replay_h__
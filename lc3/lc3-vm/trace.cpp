@@ -0,0 +1,131 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    FILE *open_trace(const char *path)
+    {
+        FILE *file = nullptr;
+#ifdef _WIN32
+        fopen_s(&file, path, "wb");
+#else
+        file = fopen(path, "wb");
+#endif
+        return file;
+    }
+}
+
+trace_recorder::trace_recorder(size_t capacity)
+    : head_(0), tail_(0), tail_seen_(0), streaming_(false), stopping_(false), file_(nullptr)
+{
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    records_.resize(size);
+    mask_ = size - 1;
+}
+
+trace_recorder::~trace_recorder()
+{
+    finish();
+}
+
+bool trace_recorder::stream(const char *path)
+{
+    finish();
+    file_ = open_trace(path);
+    if (file_ == nullptr)
+    {
+        return false;
+    }
+    fwrite(trace_magic, 1, sizeof(trace_magic), file_);
+    // anything recorded before now is not part of the stream
+    tail_ = head_.load();
+    tail_seen_ = tail_;
+    streaming_ = true;
+    stopping_ = false;
+    thread_ = std::thread(&trace_recorder::drain, this);
+    return true;
+}
+
+void trace_recorder::finish()
+{
+    if (!streaming_)
+    {
+        return;
+    }
+    stopping_ = true;
+    thread_.join();
+    streaming_ = false;
+    fclose(file_);
+    file_ = nullptr;
+}
+
+uint64_t trace_recorder::recorded() const
+{
+    return head_.load(std::memory_order_acquire);
+}
+
+std::vector<trace_record> trace_recorder::last(size_t count) const
+{
+    auto head = head_.load(std::memory_order_acquire);
+    count = static_cast<size_t>(std::min<uint64_t>({ count, head, mask_ + 1 }));
+    std::vector<trace_record> out;
+    out.reserve(count);
+    for (auto i = head - count; i != head; ++i)
+    {
+        out.push_back(records_[i & mask_]);
+    }
+    return out;
+}
+
+bool trace_recorder::write(const char *path, size_t count) const
+{
+    auto file = open_trace(path);
+    if (file == nullptr)
+    {
+        return false;
+    }
+    auto records = last(count);
+    fwrite(trace_magic, 1, sizeof(trace_magic), file);
+    fwrite(records.data(), sizeof(trace_record), records.size(), file);
+    return fclose(file) == 0;
+}
+
+void trace_recorder::wait_for_room(uint64_t head)
+{
+    while (head - (tail_seen_ = tail_.load(std::memory_order_acquire)) > mask_)
+    {
+        std::this_thread::yield();
+    }
+}
+
+void trace_recorder::drain()
+{
+    while (true)
+    {
+        // read stopping_ first so the last pass sees everything recorded
+        bool last = stopping_;
+        auto head = head_.load(std::memory_order_acquire);
+        auto tail = tail_.load(std::memory_order_relaxed);
+        while (tail != head)
+        {
+            // up to the end of the ring at a time, the vm does not touch
+            // records between tail and head
+            auto start = tail & mask_;
+            auto count = std::min<uint64_t>(head - tail, mask_ + 1 - start);
+            fwrite(&records_[start], sizeof(trace_record), count, file_);
+            tail += count;
+            tail_.store(tail, std::memory_order_release);
+        }
+        if (last)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef __trace_h__
+#define __trace_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One retired instruction. value is the register the instruction wrote, the
+// word it stored or, for control flow, the next pc; address is the memory
+// word it read or wrote and 0 for everything else.
+struct trace_record
+{
+    uint16_t pc;
+    uint16_t inst;
+    uint16_t value;
+    uint16_t address;
+};
+
+// Trace files start with this, followed by host order trace_records.
+const char trace_magic[8] = { 'L', 'C', '3', 'T', 'R', 'A', 'C', 'E' };
+
+// Ring of the newest trace records, attached with vm::set_tracer(). The vm
+// is the only writer and never takes a lock. On its own the ring keeps the
+// last capacity records; stream() adds a thread that drains it into a file
+// as it fills, and then the vm waits rather than overwrite anything the
+// thread has not written yet.
+class trace_recorder
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit trace_recorder(size_t capacity = 1 << 20);
+    ~trace_recorder();
+
+    void record(uint16_t pc, uint16_t inst, uint16_t value, uint16_t address)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (streaming_ && head - tail_seen_ > mask_)
+            wait_for_room(head);
+        records_[head & mask_] = { pc, inst, value, address };
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // call before the vm runs, fails if the file cannot be created
+    bool stream(const char *path);
+    // writes what is left and stops the streaming thread
+    void finish();
+
+    uint64_t recorded() const;
+    // the newest count records still in the ring, oldest first; only while
+    // the vm is not running
+    std::vector<trace_record> last(size_t count) const;
+    // last() in the streaming file format
+    bool write(const char *path, size_t count) const;
+
+private:
+    void wait_for_room(uint64_t head);
+    void drain();
+
+private:
+    std::vector<trace_record> records_;
+    uint64_t mask_;
+    std::atomic<uint64_t> head_;    // written by the vm
+    std::atomic<uint64_t> tail_;    // written by the streaming thread
+    uint64_t tail_seen_;            // the vm's copy of tail_
+    bool streaming_;
+    std::atomic<bool> stopping_;
+    FILE *file_;
+    std::thread thread_;
+};
+
+#endif // __trace_h__
@@ -0,0 +1,18 @@
+#include "traps.h"
+
+trap_table::trap_table(memory &ram, std::bitset<256> &natives)
+    : ram_(ram), natives_(natives)
+{
+}
+
+uint16_t trap_table::read(uint16_t address)
+{
+    return ram_.get()[address];
+}
+
+void trap_table::write(uint16_t address, uint16_t value)
+{
+    ram_.get()[address] = value;
+    ram_.dirty_pages()[address >> memory::page_bits] = 1;
+    natives_.reset(address & 0xFF);
+}
@@ -0,0 +1,40 @@
+#ifndef __traps_h__
+#define __traps_h__
+
+#include "memory.h"
+
+#include <bitset>
+
+enum traps
+{
+    tr_getc = 0x20,
+    tr_out = 0x21,
+    tr_puts = 0x22,
+    tr_in = 0x23,
+    tr_putsp = 0x24,
+    tr_halt = 0x25,
+    // bulk memory routines that only exist natively, R0 is the destination
+    // or string, R1 the source or fill value and R2 the count
+    tr_memcpy = 0x30,
+    tr_memset = 0x31,
+    tr_strlen = 0x32
+};
+
+// The trap vector table, x0000-x00FF. It is plain memory, but the page is
+// mapped as a device so stores from every engine come through here: a
+// program that installs its own routine for a vector turns the native
+// routine for that vector off. Loading an image over the table does not.
+class trap_table : public device
+{
+public:
+    trap_table(memory &ram, std::bitset<256> &natives);
+
+    uint16_t read(uint16_t address) override;
+    void write(uint16_t address, uint16_t value) override;
+
+private:
+    memory &ram_;
+    std::bitset<256> &natives_;
+};
+
+#endif // __traps_h__
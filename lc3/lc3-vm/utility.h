@@ -2,7 +2,6 @@
 #define __utility_h__
 
 #include <stdint.h>
-#include <intrin.h>
 
 inline uint16_t sign_extend(uint16_t value, int bit_count)
 {
@@ -13,9 +12,10 @@ inline uint16_t sign_extend(uint16_t value, int bit_count)
     return value;
 }
 
+// compilers turn this into a single rotate
 inline uint16_t flip16(uint16_t value)
 {
-    return _byteswap_ushort(value);
+    return static_cast<uint16_t>((value << 8) | (value >> 8));
 }
 
 
@@ -1,329 +1,1312 @@
 #include "vm.h"
 
+#include "config.h"
+#include "console.h"
 #include "flags.h"
-#include "utility.h"
+#include "object.h"
 #include "op_codes.h"
 
-#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-#include <conio.h>
-#include <signal.h>
+vm::vm()
+    : vm(std::unique_ptr<input_source>(new console_input()),
+        std::unique_ptr<output_buffer>(new output_buffer(
+            std::unique_ptr<output_sink>(new console_sink()), 4096, std::chrono::milliseconds(50))))
+{
+}
 
-#undef max
+vm::vm(std::unique_ptr<input_source> source, std::unique_ptr<output_buffer> out)
+    : trap_table_(memory_, native_traps_), watches_(interrupts_)
+{
+    memory_.set_watcher(&watches_);
+    memory_.map(0x0000, 0x00FF, &trap_table_);
+    memory_.map(mmaps::kbsr, mmaps::kbdr, &keyboard_);
+    auto &routines = trap_routines();
+    for (int v = 0; v < 256; ++v)
+    {
+        native_traps_[v] = routines[v] != nullptr;
+    }
+    keyboard_.connect(&interrupts_);
+    set_input(std::move(source));
+    set_output(std::move(out));
+    use_jit(true);
+    reset();
+}
 
-enum traps
+vm::~vm()
 {
-    tr_getc = 0x20,
-    tr_out = 0x21,
-    tr_puts = 0x22,
-    tr_in = 0x23,
-    tr_putsp = 0x24,
-    tr_halt = 0x25
-};
+}
 
-vm::vm()
+void vm::set_entry(uint16_t address)
 {
-    enable_echo(false);
+    entry_ = address;
 }
 
-vm::~vm()
+void vm::reset()
 {
-    enable_echo(true);
+    pc() = entry_;
+    // user mode at PL0, the supervisor stack grows down from x3000
+    set_psr(0x8000 | flags::zero);
+    registers_[registers::saved_ssp] = 0x3000;
+    registers_[registers::saved_usp] = 0;
+    interrupts_.clear();
+    running_ = true;
+    stop_ = false;
+    prompted_ = false;
+    executed_ = 0;
 }
 
 void vm::run()
 {
-    pc() = 0x3000;
-    running_ = true;
-    while (running_)
+    reset();
+    while (true)
     {
-        auto inst = next_instruction();
-        auto op = static_cast<op_codes>(inst >> 12);
-        switch (op)
+        switch (run_for(std::numeric_limits<int64_t>::max()))
         {
-        case op_codes::op_add:
-            add(inst);
-            break;
-        case op_codes::op_and:
-            do_and(inst);
-            break;
-        case op_codes::op_not:
-            do_not(inst);
-            break;
-        case op_codes::op_br:
-            br(inst);
-            break;
-        case op_codes::op_jsr:
-            jsr(inst);
-            break;
-        case op_codes::op_ld:
-            ld(inst);
-            break;
-        case op_codes::op_ldi:
-            ldi(inst);
-            break;
-        case op_codes::op_ldr:
-            ldr(inst);
-            break;
-        case op_codes::op_lea:
-            lea(inst);
-            break;
-        case op_codes::op_st:
-            st(inst);
-            break;
-        case op_codes::op_sti:
-            sti(inst);
-            break;
-        case op_codes::op_str:
-            str(inst);
-            break;
-        case op_codes::op_trap:
-            trap(inst);
-            break;
-        case op_codes::op_jmp:
-            jmp(inst);
+        case exit_reason::budget:
             break;
-        case op_codes::op_res:
-        case op_codes::op_rti:
-        default:
-            std::abort();
+        case exit_reason::blocked:
+            if (!input_->wait())
+            {
+                return;
+            }
             break;
+        case exit_reason::illegal:
+            output_->put("Illegal instruction\n");
+            output_->flush();
+            return;
+        case exit_reason::halted:
+            return;
+        case exit_reason::breakpoint:
+        case exit_reason::watchpoint:
+        case exit_reason::paused:
+            // back to whoever is debugging
+            return;
         }
     }
 }
 
+exit_reason vm::run_for(uint64_t budget)
+{
+    if (!running_)
+    {
+        return exit_reason::halted;
+    }
+    stop_ = false;
+    int64_t start = static_cast<int64_t>(std::min<uint64_t>(budget, std::numeric_limits<int64_t>::max()));
+    int64_t remaining = start;
+    while (remaining > 0 && !stop_)
+    {
+        // the timer cuts the budget at its next tick, so the engines never
+        // count for it
+        int64_t slice = remaining;
+        uint64_t now = executed_ + (start - remaining);
+        if (timer_period_)
+        {
+            slice = static_cast<int64_t>(std::min<uint64_t>(slice, timer_period_ - now % timer_period_));
+        }
+        if (extension_poll_)
+        {
+            slice = static_cast<int64_t>(std::min<uint64_t>(slice, extension_poll_ - now % extension_poll_));
+        }
+        // recorded and replayed keys only show up between slices
+        input_->advance(now);
+        slice = static_cast<int64_t>(std::min<uint64_t>(slice, input_->due(now) - now));
+        remaining -= slice - run_engines(slice);
+        now = executed_ + (start - remaining);
+        if (timer_period_ && !stop_ && now % timer_period_ == 0)
+        {
+            interrupts_.raise(timer_vector_, timer_priority_);
+        }
+        // like the LC-3 Simulator, only while no handler is running
+        if (extension_poll_ && !stop_ && now % extension_poll_ == 0 && (registers_[registers::psr] & 0x0700) == 0)
+        {
+            auto vector = extension_->fire(*this);
+            if (vector >= 0)
+            {
+                interrupts_.raise(static_cast<uint8_t>(vector), extension::priority);
+            }
+        }
+    }
 
-void vm::load(std::istream &stream)
+    executed_ += start - remaining;
+    if (!stop_)
+    {
+        return exit_reason::budget;
+    }
+    if (reason_ == exit_reason::blocked || reason_ == exit_reason::illegal || reason_ == exit_reason::breakpoint)
+    {
+        // every engine counts the instruction that stopped it, but this one
+        // will run again
+        --executed_;
+    }
+    return reason_;
+}
+
+int64_t vm::run_engines(int64_t budget)
+{
+    if (profiler_ || tracer_)
+    {
+        // the engines below only get what is left, which is nothing
+        budget = instrumented(budget);
+    }
+    if (aot_ && !debugging())
+    {
+        budget = run_aot(budget);
+    }
+#ifdef LC3_JIT
+    if (jit_enabled_ && !jit_)
+    {
+        jit_.reset(new jit());
+    }
+    if (jit_ && !stop_ && budget > 0)
+    {
+        budget = run_jit(budget);
+    }
+#endif
+    if (!stop_ && budget > 0)
+    {
+        budget = interpret(budget);
+    }
+    return budget;
+}
+
+exit_reason vm::step()
+{
+    return run_for(1);
+}
+
+uint64_t vm::executed() const
+{
+    return executed_;
+}
+
+void vm::stop(exit_reason reason)
 {
-    uint16_t origin;
-    stream.read(reinterpret_cast<char*>(&origin), sizeof(uint16_t));
-    origin = flip16(origin);
+    stop_ = true;
+    reason_ = reason;
+}
+
+void vm::illegal()
+{
+    pc() = pc() - 1;
+    stop(exit_reason::illegal);
+}
 
-    uint16_t max_fs = std::numeric_limits<uint16_t>::max() - origin;
-    auto loc = memory_.get() + origin;
-    stream.read(reinterpret_cast<char *>(loc), max_fs * 2);
-    auto rd = stream.gcount();
-    while (rd--)
+// Enters the handler of the highest pending line the running priority does
+// not mask: switches to the supervisor stack if need be, pushes PSR and PC
+// and raises the priority to that of the line. A stop request stops the vm
+// instead, every engine looks at stop_ after calling this.
+void vm::interrupt()
+{
+    if (interrupts_.take_stop())
+    {
+        stop(watches_.take(last_watch_) ? exit_reason::watchpoint : exit_reason::paused);
+        return;
+    }
+    uint8_t vector;
+    int priority;
+    auto old = reg(registers::psr);
+    if (!interrupts_.take((old >> 8) & 7, vector, priority))
     {
-        *loc = flip16(*loc);
-        ++loc;
+        return;
     }
+    auto &sp = registers_[registers::r6];
+    if (old & 0x8000)
+    {
+        registers_[registers::saved_usp] = sp;
+        sp = registers_[registers::saved_ssp];
+    }
+    store(--sp, old);
+    store(--sp, pc());
+    // the condition codes are saved in the pushed PSR, Z keeps every engine
+    // reading the same flags until the handler sets its own
+    set_psr(static_cast<uint16_t>((priority << 8) | flags::zero));
+    pc() = memory_.read(0x0100 + vector);
 }
 
-uint16_t vm::next_instruction()
+void vm::set_psr(uint16_t value)
 {
-    auto addr = registers_[registers::pc]++;
-    return memory_.read(addr);
+    registers_[registers::psr] = value & 0x8700;
+    cc_ = cc_value(value & 0x0007);
+    level_mask_ = (2u << ((value >> 8) & 7)) - 1;
+}
+
+int64_t vm::interpret(int64_t budget)
+{
+#ifdef LC3_THREADED_DISPATCH
+    // indexed by op_codes, each handler ends with its own indirect jump
+    static void *const dispatch[] =
+    {
+        &&l_br, &&l_add, &&l_ld, &&l_st,
+        &&l_jsr, &&l_and, &&l_ldr, &&l_str,
+        &&l_rti, &&l_not, &&l_ldi, &&l_sti,
+        &&l_jmp, &&l_res, &&l_lea, &&l_trap,
+        &&l_break,
+        // indexed by fusion past op_break, see fused_handler()
+        &&l_clear_add, &&l_negate, &&l_add_br, &&l_and_br,
+        &&l_ld_br, &&l_ldr_br, &&l_ldr_add, &&l_add_add,
+        &&l_add_add_br, &&l_ldr_add_str, &&l_ld_add_st
+    };
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == static_cast<size_t>(op_codes::op_break) + static_cast<size_t>(fusion::count),
+        "a handler for every opcode and fusion");
+    const decoded *inst;
+
+#define DISPATCH() \
+    if (budget == 0) \
+        return 0; \
+    if (interrupts_.pending() > level_mask_) \
+    { \
+        interrupt(); \
+        if (stop_) \
+            return budget; \
+    } \
+    --budget; \
+    inst = &next_instruction(); \
+    goto *dispatch[inst->handler]
+
+    // the rest of a fused sequence follows inst in its page; without the
+    // budget for all of it, or while a watchpoint has to stop the vm right
+    // after the instruction that tripped it, only the first one runs
+#define FUSED(n) \
+    if (budget < n - 1 || !fusing_) \
+        goto *dispatch[static_cast<int>(inst->op)]; \
+    budget -= n - 1
+
+    DISPATCH();
+l_add:
+    add(*inst);
+    DISPATCH();
+l_and:
+    do_and(*inst);
+    DISPATCH();
+l_not:
+    do_not(*inst);
+    DISPATCH();
+l_br:
+    br(*inst);
+    DISPATCH();
+l_jsr:
+    jsr(*inst);
+    DISPATCH();
+l_ld:
+    ld(*inst);
+    DISPATCH();
+l_ldi:
+    ldi(*inst);
+    DISPATCH();
+l_ldr:
+    ldr(*inst);
+    DISPATCH();
+l_lea:
+    lea(*inst);
+    DISPATCH();
+l_st:
+    st(*inst);
+    DISPATCH();
+l_sti:
+    sti(*inst);
+    DISPATCH();
+l_str:
+    str(*inst);
+    DISPATCH();
+l_jmp:
+    jmp(*inst);
+    DISPATCH();
+l_trap:
+    // traps are the only handlers that can stop the machine
+    trap(*inst);
+    if (stop_)
+    {
+        return budget;
+    }
+    DISPATCH();
+l_rti:
+    rti(*inst);
+    if (stop_)
+    {
+        return budget;
+    }
+    DISPATCH();
+l_res:
+    reserved(*inst);
+    if (stop_)
+    {
+        return budget;
+    }
+    DISPATCH();
+l_break:
+    breakpoint(*inst);
+    if (stop_)
+    {
+        return budget;
+    }
+    DISPATCH();
+l_clear_add:
+    FUSED(2);
+    registers_[inst->dr] = inst[1].imm;
+    set_cc(inst->dr);
+    ++pc();
+    DISPATCH();
+l_negate:
+    FUSED(2);
+    registers_[inst->dr] = static_cast<uint16_t>(0 - registers_[inst->sr1]);
+    set_cc(inst->dr);
+    ++pc();
+    DISPATCH();
+l_add_br:
+    FUSED(2);
+    add(inst[0]);
+    ++pc();
+    br(inst[1]);
+    DISPATCH();
+l_and_br:
+    FUSED(2);
+    do_and(inst[0]);
+    ++pc();
+    br(inst[1]);
+    DISPATCH();
+l_ld_br:
+    FUSED(2);
+    ld(inst[0]);
+    ++pc();
+    br(inst[1]);
+    DISPATCH();
+l_ldr_br:
+    FUSED(2);
+    ldr(inst[0]);
+    ++pc();
+    br(inst[1]);
+    DISPATCH();
+l_ldr_add:
+    FUSED(2);
+    ldr(inst[0]);
+    ++pc();
+    add(inst[1]);
+    DISPATCH();
+l_add_add:
+    FUSED(2);
+    add(inst[0]);
+    ++pc();
+    add(inst[1]);
+    DISPATCH();
+l_add_add_br:
+    FUSED(3);
+    add(inst[0]);
+    ++pc();
+    add(inst[1]);
+    ++pc();
+    br(inst[2]);
+    DISPATCH();
+l_ldr_add_str:
+    // stores only ever end a sequence, what they write may be the sequence
+    FUSED(3);
+    ldr(inst[0]);
+    ++pc();
+    add(inst[1]);
+    ++pc();
+    str(inst[2]);
+    DISPATCH();
+l_ld_add_st:
+    FUSED(3);
+    ld(inst[0]);
+    ++pc();
+    add(inst[1]);
+    ++pc();
+    st(inst[2]);
+    DISPATCH();
+
+#undef FUSED
+#undef DISPATCH
+#else
+    while (budget > 0 && !stop_)
+    {
+        if (interrupts_.pending() > level_mask_)
+        {
+            interrupt();
+            if (stop_)
+                break;
+        }
+        --budget;
+        auto &inst = next_instruction();
+        auto sequence = fused(inst);
+        auto rest = static_cast<int64_t>(fusion_length(sequence)) - 1;
+        if (sequence != fusion::none && budget >= rest && fusing_)
+        {
+            budget -= rest;
+            execute_fused(sequence, &inst);
+        }
+        else
+        {
+            execute(inst);
+        }
+    }
+    return budget;
+#endif
 }
 
-uint16_t vm::regaddr_at(uint16_t loc, uint16_t inst)
+void vm::set_input(std::unique_ptr<input_source> source)
 {
-    return (inst >> loc) & 0x7;
+    input_ = std::move(source);
+    keyboard_.attach(input_.get());
 }
 
-void vm::set_cc(uint16_t reg_addr)
+void vm::set_output(std::unique_ptr<output_buffer> out)
+{
+    output_ = std::move(out);
+}
+
+output_buffer &vm::output()
 {
-    auto v = registers_[reg_addr];
-    auto &cond_reg = registers_[registers::cond];
-    if (v == 0)
+    return *output_;
+}
+
+interrupt_controller &vm::interrupts()
+{
+    return interrupts_;
+}
+
+void vm::set_timer(uint8_t vector, int priority, uint64_t period)
+{
+    timer_vector_ = vector;
+    timer_priority_ = priority;
+    timer_period_ = period;
+}
+
+void vm::set_extension(extension *ext, uint64_t poll)
+{
+    extension_ = ext;
+    extension_poll_ = ext && ext->fires_interrupts() ? poll : 0;
+}
+
+vm_snapshot vm::snapshot()
+{
+    store_cond();
+    return { memory_.capture(), registers_, running_, prompted_, entry_, executed_, keyboard_.latch(),
+        keyboard_.interrupts_enabled(), native_traps_, aot_, nullptr };
+}
+
+void vm::restore(const vm_snapshot &state)
+{
+    auto changed = memory_.restore(state.memory);
+    for (auto page : changed)
     {
-        cond_reg = flags::zero;
+        decoded_.invalidate_page(page);
     }
-    else if ((v & 0x8000) == 0x8000)
+    if (state.decoded)
     {
-        cond_reg = flags::neg;
+        decoded_.adopt(*state.decoded);
     }
-    else
+#ifdef LC3_JIT
+    // compiled code survives unless one of its pages changed
+    auto compiled = [this](size_t page)
     {
-        cond_reg = flags::pos;
+        auto map = jit_->code_map() + (page << memory::page_bits);
+        return std::any_of(map, map + (1 << memory::page_bits), [](uint8_t c) { return c != 0; });
+    };
+    if (jit_ && std::any_of(changed.begin(), changed.end(), compiled))
+    {
+        jit_->flush();
     }
+#endif
+    registers_ = state.regs;
+    load_cond();
+    running_ = state.running;
+    prompted_ = state.prompted;
+    entry_ = state.entry;
+    executed_ = state.executed;
+    keyboard_.set_latch(state.keyboard);
+    keyboard_.enable_interrupts(state.keyboard_interrupts);
+    native_traps_ = state.native_traps;
+    aot_ = state.aot;
+    stop_ = false;
 }
 
-uint16_t& vm::pc()
+std::unique_ptr<vm> vm::fork(std::unique_ptr<input_source> source, std::unique_ptr<output_buffer> out)
 {
-    return registers_[registers::pc];
+    std::unique_ptr<vm> child(new vm(std::move(source), std::move(out)));
+    child->use_jit(jit_enabled_);
+    child->set_fusions(decoded_.fusions());
+    child->set_timer(timer_vector_, timer_priority_, timer_period_);
+    child->extension_ = extension_;
+    child->extension_poll_ = extension_poll_;
+    child->native_traps_ = native_traps_;
+    child->host_traps_ = host_traps_;
+    child->restore(snapshot());
+    return child;
 }
 
-void vm::add(uint16_t inst)
+void vm::set_breakpoint(uint16_t address)
 {
-    auto dra = (inst >> 9) & 0x7;
-    auto r1 = (inst >> 6) & 0x7;
-    auto imm = (inst >> 5) & 0x1;
-    if (imm)
+    decoded_.set_breakpoint(address, true);
+#ifdef LC3_JIT
+    // blocks compiled across it have to end there now
+    if (jit_ && jit_->compiled(address))
     {
-        auto val = sign_extend(inst & 0x1F, 5);
-        registers_[dra] = registers_[r1] + val;
+        jit_->flush();
     }
-    else
+#endif
+}
+
+void vm::clear_breakpoint(uint16_t address)
+{
+    decoded_.set_breakpoint(address, false);
+    if (resume_at_ == address)
+    {
+        resume_at_ = -1;
+    }
+}
+
+void vm::set_watchpoint(uint16_t first, uint16_t last, watch_kind kind)
+{
+    watches_.add(first, last, kind);
+    watches_.watch_pages(memory_);
+    fusing_ = false;
+    drop_compiled();
+}
+
+void vm::clear_watchpoint(uint16_t first, uint16_t last)
+{
+    watches_.remove(first, last);
+    watches_.watch_pages(memory_);
+    fusing_ = watches_.empty();
+    drop_compiled();
+}
+
+void vm::clear_debug()
+{
+    for (uint32_t address = 0; address < 0x10000 && decoded_.any_breakpoints(); ++address)
     {
-        auto r2 = inst & 0x7;
-        registers_[dra] = registers_[r1] + registers_[r2];
+        decoded_.set_breakpoint(static_cast<uint16_t>(address), false);
     }
-    set_cc(dra);
+    resume_at_ = -1;
+    watches_.clear();
+    watches_.watch_pages(memory_);
+    fusing_ = true;
+    drop_compiled();
+}
+
+const watch_hit &vm::last_watch() const
+{
+    return last_watch_;
+}
+
+void vm::pause()
+{
+    interrupts_.request_stop();
 }
 
-void vm::do_and(uint16_t inst)
+uint16_t vm::reg(registers r) const
 {
-    auto dra = (inst >> 9) & 0x7;
-    auto sra = (inst >> 6) & 0x7;
-    auto imm = (inst >> 5) & 0x01;
+    if (r == registers::psr)
+        return registers_[registers::psr] | cc_flags(cc_);
+    if (r == registers::cond)
+        return cc_flags(cc_);
+    return registers_[r];
+}
 
-    auto &dr = registers_[dra];
-    auto sr = registers_[sra];
-    if (imm)
+void vm::set_reg(registers r, uint16_t value)
+{
+    if (r == registers::psr || r == registers::cond)
     {
-        auto imv = sign_extend(inst & 0x1F, 5);
-        dr = sr & imv;
+        set_psr(r == registers::psr ? value : static_cast<uint16_t>(registers_[registers::psr] | (value & 0x0007)));
+        return;
     }
-    else
+    registers_[r] = value;
+    if (r == registers::pc)
     {
-        auto sr2a = (inst & 0x7);
-        auto sr2 = registers_[sr2a];
-        dr = sr & sr2;
+        resume_at_ = -1;
     }
-    set_cc(dra);
 }
 
-void vm::do_not(uint16_t inst)
+uint16_t vm::peek(uint16_t address)
 {
-    auto dra = regaddr_at(9, inst);
-    auto sra = regaddr_at(6, inst);
-    registers_[dra] = ~registers_[sra];
-    set_cc(dra);
+    return memory_.get()[address];
 }
 
-void vm::br(uint16_t inst)
+void vm::poke(uint16_t address, uint16_t value)
 {
-    auto offset = sign_extend(inst & 0x1FF, 9);
-    auto cond = (inst >> 9) & 0x7;
-    auto rv = registers_[registers::cond];
-    if (rv&cond)
+    store(address, value);
+}
+
+bool vm::debugging() const
+{
+    return decoded_.any_breakpoints() || !watches_.empty();
+}
+
+// Compiled code checked for device pages when it was compiled, and watching a
+// page makes it one.
+void vm::drop_compiled()
+{
+#ifdef LC3_JIT
+    if (jit_)
     {
-        pc() = pc() + offset;
+        jit_->flush();
     }
+#endif
 }
 
-void vm::ldi(uint16_t inst)
+void vm::set_fusions(const fusion_set &enabled)
 {
-    auto r0 = (inst >> 9) & 0x7;
-    auto offset = sign_extend(inst & 0x1FF, 9);
-    registers_[r0] = memory_.read(memory_.read(registers_[registers::pc] + offset));
-    set_cc(r0);
+    decoded_.set_fusions(enabled);
 }
 
-void vm::ld(uint16_t inst)
+void vm::set_profiler(profiler *p)
 {
-    auto offset = sign_extend(inst & 0x00FF, 8);
-    auto dra = (inst >> 9) & 0x7;
-    registers_[dra] = memory_.read(pc() + offset);
-    set_cc(dra);
+    profiler_ = p;
+    if (profiler_)
+    {
+        profiler_->begin(entry_);
+    }
 }
 
-void vm::ldr(uint16_t inst)
+void vm::set_tracer(trace_recorder *t)
 {
-    auto dra = regaddr_at(9, inst);
-    auto base = regaddr_at(6, inst);
-    auto offset = sign_extend((inst & 0x1F), 5);
-    auto br = registers_[base];
-    registers_[dra] = memory_.read(br + offset);
-    set_cc(dra);
+    tracer_ = t;
 }
 
-void vm::lea(uint16_t inst)
+void vm::use_jit(bool enable)
 {
-    auto dra = regaddr_at(9, inst);
-    auto offset = sign_extend(inst & 0x1FF, 9);
-    registers_[dra] = pc() + offset;
-    set_cc(dra);
+    jit_enabled_ = enable;
+#ifdef LC3_JIT
+    if (!enable)
+    {
+        jit_.reset();
+    }
+#endif
 }
 
-void vm::jmp(uint16_t inst)
+int64_t vm::run_jit(int64_t budget)
 {
-    auto ra = (inst >> 6) & 0x7;
-    auto rsv = registers_[ra];
-    pc() = rsv;
+#ifdef LC3_JIT
+    jit_frame frame = { registers_.data(), memory_.get(), jit_->code_map(), 0, 0, memory_.device_pages(),
+        memory_.dirty_pages(), interrupts_.pending_word(), 0, decoded_.any_breakpoints() ? &decoded_ : nullptr };
+    while (budget > 0 && !stop_)
+    {
+        // blocks leave as soon as they find an interrupt the priority allows
+        if (interrupts_.pending() > level_mask_)
+        {
+            interrupt();
+            if (stop_)
+                break;
+        }
+        frame.budget = budget;
+        frame.level_mask = level_mask_;
+        frame.cc = cc_;
+        auto next = jit_->run(frame, pc());
+        cc_ = static_cast<uint16_t>(frame.cc);
+        budget = frame.budget;
+        pc() = static_cast<uint16_t>(next);
+        if (next & jit::budget)
+        {
+            // the next block does not fit, finish the slice one by one
+            return interpret(budget);
+        }
+        if ((next & jit::interpret) && budget > 0)
+        {
+            --budget;
+            execute(next_instruction());
+        }
+    }
+#endif
+    return budget;
 }
 
-void vm::jsr(uint16_t inst)
+int64_t vm::run_aot(int64_t budget)
 {
-    registers_[registers::r7] = pc();
-    auto long_jsr = (inst >> 11) & 0x1;
-    if (long_jsr)
+    aot_state state = { registers_.data(), memory_.get(), memory_.device_pages(), memory_.dirty_pages(),
+        cc_, budget, aot_, &decoded_, this };
+    while (state.budget > 0 && !stop_ && aot_)
     {
-        auto v = sign_extend(inst & 0x7FF, 11);
-        pc() = pc() + v;        
+        if (interrupts_.pending() > level_mask_)
+        {
+            cc_ = state.cc;
+            interrupt();
+            state.cc = cc_;
+            if (stop_)
+                break;
+        }
+        auto block = aot_->find(pc());
+        uint32_t next = pc() | aot_state::interpret;
+        if (block != nullptr)
+        {
+            next = block(state);
+            pc() = static_cast<uint16_t>(next);
+        }
+        if ((next & aot_state::interpret) && state.budget > 0)
+        {
+            cc_ = state.cc;
+            --state.budget;
+            execute(next_instruction());
+            state.cc = cc_;
+        }
     }
-    else
+    cc_ = state.cc;
+    return state.budget;
+}
+
+int64_t vm::instrumented(int64_t budget)
+{
+    while (budget > 0 && !stop_)
     {
-        auto sra = (inst >> 6) & 0x7;
-        pc() = registers_[sra];
+        if (interrupts_.pending() > level_mask_)
+        {
+            interrupt();
+            if (stop_)
+                break;
+        }
+        --budget;
+        uint16_t at = pc();
+        auto &next = next_instruction();
+        // what a breakpoint stands for, once it lets the instruction run
+        auto inst = next.op == op_codes::op_break ? unmarked(next) : next;
+        uint16_t address = tracer_ ? accessed(inst) : 0;
+        execute(next);
+        // a blocked or illegal instruction, or one a breakpoint held, did not retire
+        if (stop_ && reason_ != exit_reason::halted)
+        {
+            break;
+        }
+        if (profiler_)
+        {
+            profiler_->retired(at, inst, pc());
+        }
+        if (tracer_)
+        {
+            tracer_->record(at, inst.inst, written(inst), address);
+        }
     }
+    return budget;
 }
 
-void vm::st(uint16_t inst)
+// The memory word inst is about to read or write, pc is already past it.
+uint16_t vm::accessed(const decoded &inst)
 {
-    auto offset = sign_extend(inst & 0x1FF, 9);
-    auto sra = regaddr_at(9, inst);
-    memory_.write(pc() + offset, registers_[sra]);
+    switch (inst.op)
+    {
+    case op_codes::op_ld:
+    case op_codes::op_st:
+        return pc() + inst.imm;
+    case op_codes::op_ldi:
+    case op_codes::op_sti:
+        // the pointer itself, without device side effects
+        return memory_.get()[static_cast<uint16_t>(pc() + inst.imm)];
+    case op_codes::op_ldr:
+    case op_codes::op_str:
+        return registers_[inst.sr1] + inst.imm;
+    default:
+        return 0;
+    }
 }
 
-void vm::sti(uint16_t inst)
+// The value inst produced once it has run.
+uint16_t vm::written(const decoded &inst)
 {
-    auto offset = sign_extend(inst & 0x1FF, 9);
-    auto sra = regaddr_at(9, inst);
-    auto addr = memory_.read(pc() + offset);
-    memory_.write(addr, registers_[sra]);
+    switch (inst.op)
+    {
+    case op_codes::op_br:
+    case op_codes::op_jmp:
+    case op_codes::op_jsr:
+    case op_codes::op_rti:
+        return pc();
+    case op_codes::op_trap:
+        return registers_[registers::r0];
+    case op_codes::op_res:
+        return 0;
+    default:
+        // loads, lea and the alu write dr, stores store it
+        return registers_[inst.dr];
+    }
 }
 
-void vm::str(uint16_t inst)
+void vm::execute(const decoded &inst)
 {
-    auto sra = regaddr_at(9, inst);
-    auto bra = regaddr_at(6, inst);
-    auto offset = sign_extend(inst & 0x3F, 6);
-    auto br = registers_[bra];
-    memory_.write(br + offset, registers_[sra]);
+    switch (inst.op)
+    {
+    case op_codes::op_add:
+        add(inst);
+        break;
+    case op_codes::op_and:
+        do_and(inst);
+        break;
+    case op_codes::op_not:
+        do_not(inst);
+        break;
+    case op_codes::op_br:
+        br(inst);
+        break;
+    case op_codes::op_jsr:
+        jsr(inst);
+        break;
+    case op_codes::op_ld:
+        ld(inst);
+        break;
+    case op_codes::op_ldi:
+        ldi(inst);
+        break;
+    case op_codes::op_ldr:
+        ldr(inst);
+        break;
+    case op_codes::op_lea:
+        lea(inst);
+        break;
+    case op_codes::op_st:
+        st(inst);
+        break;
+    case op_codes::op_sti:
+        sti(inst);
+        break;
+    case op_codes::op_str:
+        str(inst);
+        break;
+    case op_codes::op_trap:
+        trap(inst);
+        break;
+    case op_codes::op_jmp:
+        jmp(inst);
+        break;
+    case op_codes::op_rti:
+        rti(inst);
+        break;
+    case op_codes::op_res:
+        reserved(inst);
+        break;
+    case op_codes::op_break:
+        breakpoint(inst);
+        break;
+    default:
+        illegal();
+        break;
+    }
 }
 
-void vm::trap(uint16_t inst)
+// The switch engine's fused handlers, inst is the first of the sequence and
+// pc is past it.
+void vm::execute_fused(fusion sequence, const decoded *inst)
 {
-    switch (inst & 0x00FF)
+    switch (sequence)
     {
-    case traps::tr_getc:
-        getc();
+    case fusion::clear_add:
+        registers_[inst->dr] = inst[1].imm;
+        set_cc(inst->dr);
+        ++pc();
+        break;
+    case fusion::negate:
+        registers_[inst->dr] = static_cast<uint16_t>(0 - registers_[inst->sr1]);
+        set_cc(inst->dr);
+        ++pc();
+        break;
+    case fusion::add_br:
+        add(inst[0]);
+        ++pc();
+        br(inst[1]);
+        break;
+    case fusion::and_br:
+        do_and(inst[0]);
+        ++pc();
+        br(inst[1]);
         break;
-    case traps::tr_out:
-        out();
+    case fusion::ld_br:
+        ld(inst[0]);
+        ++pc();
+        br(inst[1]);
         break;
-    case traps::tr_puts:
-        puts();
+    case fusion::ldr_br:
+        ldr(inst[0]);
+        ++pc();
+        br(inst[1]);
         break;
-    case traps::tr_in:
-        in();
+    case fusion::ldr_add:
+        ldr(inst[0]);
+        ++pc();
+        add(inst[1]);
         break;
-    case traps::tr_putsp:
-        putsp();
+    case fusion::add_add:
+        add(inst[0]);
+        ++pc();
+        add(inst[1]);
         break;
-    case traps::tr_halt:
-        halt();
+    case fusion::add_add_br:
+        add(inst[0]);
+        ++pc();
+        add(inst[1]);
+        ++pc();
+        br(inst[2]);
+        break;
+    case fusion::ldr_add_str:
+        ldr(inst[0]);
+        ++pc();
+        add(inst[1]);
+        ++pc();
+        str(inst[2]);
+        break;
+    case fusion::ld_add_st:
+        ld(inst[0]);
+        ++pc();
+        add(inst[1]);
+        ++pc();
+        st(inst[2]);
         break;
     default:
+        execute(*inst);
         break;
     }
 }
 
+void vm::load(std::istream &stream)
+{
+    object_image image;
+    if (read_object(stream, image))
+    {
+        load(image);
+    }
+}
+
+void vm::load(const object_image &image)
+{
+    memory_.load(image.origin, image.words.data(), image.words.size());
+    decoded_.clear();
+#ifdef LC3_JIT
+    if (jit_)
+    {
+        jit_->flush();
+    }
+#endif
+    aot_ = nullptr;
+}
+
+void vm::load(const object_set &objects)
+{
+    for (auto &s : objects.segments())
+    {
+        memory_.load(s.origin, s.data, s.count);
+    }
+    decoded_.clear();
+#ifdef LC3_JIT
+    if (jit_)
+    {
+        jit_->flush();
+    }
+#endif
+    aot_ = nullptr;
+}
+
+void vm::load(const assembly &program)
+{
+    for (auto &s : program.segments)
+    {
+        memory_.load(s.origin, s.words.data(), s.words.size());
+    }
+    decoded_.clear();
+#ifdef LC3_JIT
+    if (jit_)
+    {
+        jit_->flush();
+    }
+#endif
+    aot_ = nullptr;
+}
+
+void vm::load(const aot_image &image)
+{
+    memory_.load(image.origin, image.words, image.size);
+    decoded_.clear();
+#ifdef LC3_JIT
+    if (jit_)
+    {
+        jit_->flush();
+    }
+#endif
+    aot_ = &image;
+}
+
+const decoded &vm::next_instruction()
+{
+    auto addr = registers_[registers::pc]++;
+    return decoded_.fetch(memory_, addr);
+}
+
+void vm::store(uint16_t address, uint16_t value)
+{
+    memory_.write(address, value);
+    decoded_.invalidate(address);
+    if (aot_ && aot_->translated(address))
+    {
+        aot_ = nullptr;
+    }
+#ifdef LC3_JIT
+    if (jit_ && jit_->compiled(address))
+    {
+        jit_->flush();
+    }
+#endif
+}
+
+// Words changed behind the vm's back, by an extension writing memory
+// directly: drop whatever was decoded or compiled from them.
+void vm::rewritten(uint16_t address, uint32_t count)
+{
+    count = std::min<uint32_t>(count, 0x10000);
+    auto dirty = memory_.dirty_pages();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint16_t a = static_cast<uint16_t>(address + i);
+        if (i == 0 || (a & ((1 << memory::page_bits) - 1)) == 0)
+        {
+            dirty[a >> memory::page_bits] = 1;
+            decoded_.invalidate_page(a >> memory::page_bits);
+        }
+        if (aot_ && aot_->translated(a))
+        {
+            aot_ = nullptr;
+        }
+#ifdef LC3_JIT
+        if (jit_ && jit_->compiled(a))
+        {
+            jit_->flush();
+        }
+#endif
+    }
+}
+
+// Only keeps the result; br() and whoever reads the PSR work the flags out.
+void vm::set_cc(uint16_t reg_addr)
+{
+    cc_ = registers_[reg_addr];
+}
+
+// registers_[cond] is only up to date between these two, for code that
+// reads the register file as a whole
+void vm::store_cond()
+{
+    registers_[registers::cond] = cc_flags(cc_);
+}
+
+void vm::load_cond()
+{
+    set_psr(registers_[registers::psr] | registers_[registers::cond]);
+}
+
+uint16_t& vm::pc()
+{
+    return registers_[registers::pc];
+}
+
+void vm::add(const decoded &inst)
+{
+    if (inst.mode)
+    {
+        registers_[inst.dr] = registers_[inst.sr1] + inst.imm;
+    }
+    else
+    {
+        registers_[inst.dr] = registers_[inst.sr1] + registers_[inst.sr2];
+    }
+    set_cc(inst.dr);
+}
+
+void vm::do_and(const decoded &inst)
+{
+    if (inst.mode)
+    {
+        registers_[inst.dr] = registers_[inst.sr1] & inst.imm;
+    }
+    else
+    {
+        registers_[inst.dr] = registers_[inst.sr1] & registers_[inst.sr2];
+    }
+    set_cc(inst.dr);
+}
+
+void vm::do_not(const decoded &inst)
+{
+    registers_[inst.dr] = ~registers_[inst.sr1];
+    set_cc(inst.dr);
+}
+
+void vm::br(const decoded &inst)
+{
+    if (cc_flags(cc_) & inst.dr)
+    {
+        pc() = pc() + inst.imm;
+    }
+}
+
+void vm::ldi(const decoded &inst)
+{
+    registers_[inst.dr] = memory_.read(memory_.read(pc() + inst.imm));
+    set_cc(inst.dr);
+}
+
+void vm::ld(const decoded &inst)
+{
+    registers_[inst.dr] = memory_.read(pc() + inst.imm);
+    set_cc(inst.dr);
+}
+
+void vm::ldr(const decoded &inst)
+{
+    registers_[inst.dr] = memory_.read(registers_[inst.sr1] + inst.imm);
+    set_cc(inst.dr);
+}
+
+void vm::lea(const decoded &inst)
+{
+    registers_[inst.dr] = pc() + inst.imm;
+    set_cc(inst.dr);
+}
+
+void vm::jmp(const decoded &inst)
+{
+    pc() = registers_[inst.sr1];
+}
+
+void vm::jsr(const decoded &inst)
+{
+    auto target = inst.mode ? pc() + inst.imm : registers_[inst.sr1];
+    registers_[registers::r7] = pc();
+    pc() = target;
+}
+
+void vm::st(const decoded &inst)
+{
+    store(pc() + inst.imm, registers_[inst.dr]);
+}
+
+void vm::sti(const decoded &inst)
+{
+    store(memory_.read(pc() + inst.imm), registers_[inst.dr]);
+}
+
+void vm::str(const decoded &inst)
+{
+    store(registers_[inst.sr1] + inst.imm, registers_[inst.dr]);
+}
+
+void vm::trap(const decoded &inst)
+{
+    auto vector = inst.imm & 0xFF;
+    if (native_traps_.test(vector))
+    {
+        (this->*trap_routines()[vector])();
+        return;
+    }
+    if (!host_traps_.empty() && host_traps_[vector])
+    {
+        if (!host_traps_[vector](*this))
+        {
+            block();
+        }
+        return;
+    }
+    // a vector nobody installed a routine for does nothing, as before
+    auto routine = memory_.read(vector);
+    if (routine == 0)
+        return;
+    registers_[registers::r7] = pc();
+    pc() = routine;
+}
+
+bool vm::native_trap(uint8_t vector, bool enable)
+{
+    if (trap_routines()[vector] == nullptr)
+        return !enable;
+    native_traps_[vector] = enable;
+    return true;
+}
+
+void vm::set_host_trap(uint8_t vector, host_trap routine)
+{
+    if (host_traps_.empty())
+    {
+        host_traps_.resize(256);
+    }
+    host_traps_[vector] = std::move(routine);
+}
+
+const std::array<vm::trap_routine, 256> &vm::trap_routines()
+{
+    static const std::array<trap_routine, 256> routines = []
+    {
+        std::array<trap_routine, 256> r = { nullptr };
+        r[traps::tr_getc] = &vm::getc;
+        r[traps::tr_out] = &vm::out;
+        r[traps::tr_puts] = &vm::puts;
+        r[traps::tr_in] = &vm::in;
+        r[traps::tr_putsp] = &vm::putsp;
+        r[traps::tr_halt] = &vm::halt;
+        r[traps::tr_memcpy] = &vm::mem_copy;
+        r[traps::tr_memset] = &vm::mem_fill;
+        r[traps::tr_strlen] = &vm::str_length;
+        return r;
+    }();
+    return routines;
+}
+
+// Pops PC and PSR off the supervisor stack and goes back to the user stack if
+// the PSR says so. There is no operating system to take the privilege mode
+// exception, so RTI in user mode stops the vm like any illegal instruction.
+void vm::rti(const decoded &inst)
+{
+    if (registers_[registers::psr] & 0x8000)
+    {
+        illegal();
+        return;
+    }
+    auto &sp = registers_[registers::r6];
+    pc() = memory_.read(sp++);
+    set_psr(memory_.read(sp++));
+    if (registers_[registers::psr] & 0x8000)
+    {
+        registers_[registers::saved_ssp] = sp;
+        sp = registers_[registers::saved_usp];
+    }
+}
+
+void vm::reserved(const decoded &inst)
+{
+    if (extension_)
+    {
+        extension_->execute(*this, inst);
+    }
+    else
+    {
+        illegal();
+    }
+}
+
+// Stops on the instruction under a breakpoint, unless the vm is going on
+// from that very breakpoint.
+void vm::breakpoint(const decoded &inst)
+{
+    uint16_t at = pc() - 1;
+    if (resume_at_ != at)
+    {
+        pc() = at;
+        resume_at_ = at;
+        stop(exit_reason::breakpoint);
+        return;
+    }
+    resume_at_ = -1;
+    execute(unmarked(inst));
+}
+
 void vm::getc()
-{    
-    uint16_t c = _getch();
-    c = c & 0x00FF;
-    registers_[registers::r0] = c;
+{
+    uint16_t c = 0;
+    if (!input_->poll(c))
+    {
+        block();
+        return;
+    }
+    registers_[registers::r0] = c & 0x00FF;
 }
 
 void vm::out()
 {
-    char c = registers_[registers::r0] & 0x00FF;
-    _putch(c);
+    output_->put(static_cast<char>(registers_[registers::r0] & 0x00FF));
 }
 
 void vm::puts()
@@ -332,7 +1315,7 @@ void vm::puts()
     auto val = memory_.read(addr++);
     while (val != 0)
     {
-        _putch(val);
+        output_->put(static_cast<char>(val));
         val = memory_.read(addr++);
     }
 }
@@ -343,38 +1326,118 @@ void vm::putsp()
     auto val = memory_.read(addr++);
     while (val != 0)
     {
-        auto v1 = val & 0x00FF;
-        _putch(v1);
-        auto v2 = (val >> 8) && 0x00FF;
-        if(v2 != 0)
-            _putch(v2);
+        output_->put(static_cast<char>(val & 0x00FF));
+        auto v2 = (val >> 8) & 0x00FF;
+        if (v2 != 0)
+            output_->put(static_cast<char>(v2));
         val = memory_.read(addr++);
     }
 }
 
 void vm::in()
 {
-    std::cout << "Enter a character: ";
-    auto v = _getch();
-    putc(v, stdout);
+    if (!prompted_)
+    {
+        output_->put("Enter a character: ");
+        prompted_ = true;
+    }
+    uint16_t v = 0;
+    if (!input_->poll(v))
+    {
+        block();
+        return;
+    }
+    prompted_ = false;
     v = v & 0x00FF;
-    registers_[registers::r0]=v;
+    output_->put(static_cast<char>(v));
+    registers_[registers::r0] = v;
 }
 
 void vm::halt()
 {
     running_ = false;
-    std::cout << "Halted" << std::endl;
+    stop(exit_reason::halted);
+    output_->put("Halted\n");
+    output_->flush();
 }
 
-void vm::enable_echo(bool enable)
+// count words from R1 to R0, like memmove. Plain RAM is copied in one go and
+// whatever was compiled from the destination dropped; ranges that wrap or
+// touch a device go word by word.
+void vm::mem_copy()
 {
-    HANDLE csl = GetStdHandle(STD_INPUT_HANDLE);
-    DWORD mode = { 0 };
-    GetConsoleMode(csl, &mode);
-    if (enable)
-        mode = mode & ENABLE_ECHO_INPUT & ENABLE_LINE_INPUT;
-    else
-        mode = mode & ~ENABLE_ECHO_INPUT & ~ENABLE_LINE_INPUT;
-    SetConsoleMode(csl, mode);
-}
\ No newline at end of file
+    auto dst = registers_[registers::r0];
+    auto src = registers_[registers::r1];
+    auto count = registers_[registers::r2];
+    if (plain(dst, count) && plain(src, count))
+    {
+        auto ram = memory_.get();
+        std::memmove(ram + dst, ram + src, count * sizeof(uint16_t));
+        rewritten(dst, count);
+        return;
+    }
+    std::vector<uint16_t> words(count);
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        words[i] = memory_.read(src + i);
+    }
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        store(dst + i, words[i]);
+    }
+}
+
+// R2 words from R0 set to R1
+void vm::mem_fill()
+{
+    auto dst = registers_[registers::r0];
+    auto value = registers_[registers::r1];
+    auto count = registers_[registers::r2];
+    if (plain(dst, count))
+    {
+        auto ram = memory_.get();
+        std::fill(ram + dst, ram + dst + count, value);
+        rewritten(dst, count);
+        return;
+    }
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        store(dst + i, value);
+    }
+}
+
+// R0 = the number of words before the zero that ends the string at R0
+void vm::str_length()
+{
+    auto addr = registers_[registers::r0];
+    uint16_t length = 0;
+    while (memory_.read(addr + length) != 0 && length != 0xFFFF)
+    {
+        ++length;
+    }
+    registers_[registers::r0] = length;
+}
+
+bool vm::plain(uint16_t address, uint16_t count) const
+{
+    if (count == 0)
+        return true;
+    if (address + count > 0x10000)
+        return false;
+    auto pages = memory_.device_pages();
+    for (size_t page = address >> memory::page_bits; page <= static_cast<size_t>((address + count - 1) >> memory::page_bits); ++page)
+    {
+        if (pages[page])
+            return false;
+    }
+    return true;
+}
+
+void vm::block()
+{
+    // leave pc on the trap so it runs again once there is input, or once a
+    // host routine can finish
+    output_->flush();
+    pc() = pc() - 1;
+    stop(exit_reason::blocked);
+}
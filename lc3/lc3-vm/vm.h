@@ -1,9 +1,27 @@
 #ifndef __vm_h__
 #define __vm_h__
 
+#include "aot.h"
+#include "assembler.h"
 #include "memory.h"
+#include "output.h"
+#include "debug.h"
+#include "decode_cache.h"
+#include "extension.h"
+#include "input.h"
+#include "interrupts.h"
+#include "jit.h"
+#include "keyboard.h"
+#include "object.h"
+#include "profiler.h"
+#include "trace.h"
+#include "traps.h"
 
+#include <bitset>
+#include <functional>
 #include <istream>
+#include <memory>
+#include <vector>
 
 enum registers
 {
@@ -16,40 +34,163 @@ enum registers
     r6,
     r7,
     pc,
-    cond,
+    cond,       // only in snapshots and the register file extensions see
+    psr,        // privilege (bit 15) and priority (bits 10-8), cond holds the rest
+    saved_ssp,
+    saved_usp,
     count
 };
 
+enum class exit_reason
+{
+    budget,     // ran the whole instruction budget
+    halted,
+    blocked,    // GETC/IN found no input or a host trap could not finish yet,
+                // pc is left on the trap
+    illegal,    // RTI or the reserved opcode, pc is left on the instruction
+    breakpoint, // pc is left on the instruction, which runs when the vm goes on
+    watchpoint, // right after the instruction that touched a watched word
+    paused      // vm::pause()
+};
+
+// Complete machine state taken by vm::snapshot(). Copies are cheap, the
+// memory pages are shared with the vm and with other snapshots.
+struct vm_snapshot
+{
+    std::shared_ptr<const memory_image> memory;
+    std::array<uint16_t, registers::count> regs;
+    bool running;
+    bool prompted;
+    uint16_t entry;
+    uint64_t executed;
+    uint16_t keyboard;
+    bool keyboard_interrupts;
+    std::bitset<256> native_traps;
+    const aot_image *aot;
+    // set it to predecode(*memory) and vms restoring the snapshot share
+    // those pages instead of decoding their own
+    std::shared_ptr<const decoded_image> decoded;
+};
+
+class vm;
+
+// A trap the host serves, called with pc past the TRAP. It returns false
+// when it cannot finish yet: the vm then stops as blocked with pc on the
+// TRAP, holding no thread, and the routine is called again once the vm runs
+// again. Routines work through vm::reg(), set_reg(), peek() and poke().
+typedef std::function<bool(vm &machine)> host_trap;
+
 class vm
 {
+    friend struct aot_state;
+    friend class extension;
+
 public:
     vm();
+    vm(std::unique_ptr<input_source> source, std::unique_ptr<output_buffer> out);
     ~vm();
     void load(std::istream &stream);
+    void load(const object_image &image);
+    void load(const object_set &objects);
+    void load(const aot_image &image);
+    void load(const assembly &program);
+    void set_entry(uint16_t address);
+    void reset();
     void run();
-    
+    exit_reason run_for(uint64_t budget);
+    exit_reason step();
+    uint64_t executed() const;
+    void use_jit(bool enable);
+    // sequences the interpreter runs as one handler, all_fusions() to start
+    // with; profiler::fusions() picks the ones a profiled run spent its time in
+    void set_fusions(const fusion_set &enabled);
+    // counts every instruction while set, nullptr turns profiling off
+    void set_profiler(profiler *p);
+    // records every instruction while set, nullptr turns tracing off
+    void set_tracer(trace_recorder *t);
+    // devices raise their lines here, see interrupt_controller
+    interrupt_controller &interrupts();
+    // raises vector every period instructions, 0 turns the timer off
+    void set_timer(uint8_t vector, int priority, uint64_t period);
+    // runs the reserved opcode, nullptr makes it illegal again; an extension
+    // that fires interrupts is asked every poll instructions
+    void set_extension(extension *ext, uint64_t poll = 1000);
+    // TRAP runs a native routine for vector while one is enabled, otherwise
+    // it jumps through the vector table at x0000 with the return address in
+    // R7. The standard routines x20-x25 and the bulk ones x30-x32 start
+    // enabled; vectors without a native routine cannot be enabled.
+    bool native_trap(uint8_t vector, bool enable);
+    // a host routine comes after the native one and before the vector table,
+    // nullptr removes it
+    void set_host_trap(uint8_t vector, host_trap routine);
+    void set_input(std::unique_ptr<input_source> source);
+    void set_output(std::unique_ptr<output_buffer> out);
+    output_buffer &output();
+    vm_snapshot snapshot();
+    void restore(const vm_snapshot &state);
+    std::unique_ptr<vm> fork(std::unique_ptr<input_source> source, std::unique_ptr<output_buffer> out);
+
+    // Debugging. Breakpoints are marked in the decode cache and watchpoints
+    // make their pages device pages, so while nothing is armed the engines
+    // run as they always do; while anything is, translated AOT code is not
+    // used. run_for() and step() carry on from wherever the vm stopped.
+    void set_breakpoint(uint16_t address);
+    void clear_breakpoint(uint16_t address);
+    void set_watchpoint(uint16_t first, uint16_t last, watch_kind kind);
+    void clear_watchpoint(uint16_t first, uint16_t last);
+    void clear_debug();
+    const watch_hit &last_watch() const;
+    // from any thread, run_for() returns exit_reason::paused
+    void pause();
+    uint16_t reg(registers r) const;
+    void set_reg(registers r, uint16_t value);
+    // memory as the program sees it, without reading devices
+    uint16_t peek(uint16_t address);
+    // writes memory like a store of the program
+    void poke(uint16_t address, uint16_t value);
 
 private:
-    uint16_t next_instruction();
+    int64_t run_engines(int64_t budget);
+    int64_t interpret(int64_t budget);
+    int64_t run_jit(int64_t budget);
+    int64_t run_aot(int64_t budget);
+    int64_t instrumented(int64_t budget);
+    uint16_t accessed(const decoded &inst);
+    uint16_t written(const decoded &inst);
+    void stop(exit_reason reason);
+    void interrupt();
+    void set_psr(uint16_t value);
+    void illegal();
+    void execute(const decoded &inst);
+    void execute_fused(fusion sequence, const decoded *inst);
+    const decoded &next_instruction();
     void set_cc(uint16_t reg);
+    void store_cond();
+    void load_cond();
     uint16_t& pc();
-    uint16_t regaddr_at(uint16_t loc, uint16_t inst);
+    void store(uint16_t address, uint16_t value);
+    void rewritten(uint16_t address, uint32_t count);
+    bool debugging() const;
+    void drop_compiled();
 
 private:
-    void add(uint16_t inst);
-    void do_and(uint16_t inst);
-    void do_not(uint16_t inst);
-    void br(uint16_t inst);
-    void jmp(uint16_t inst);
-    void jsr(uint16_t inst);
-    void ld(uint16_t inst);
-    void ldi(uint16_t inst);
-    void ldr(uint16_t inst);
-    void lea(uint16_t inst);
-    void st(uint16_t inst);
-    void sti(uint16_t inst);
-    void str(uint16_t inst);
-    void trap(uint16_t inst);
+    void add(const decoded &inst);
+    void do_and(const decoded &inst);
+    void do_not(const decoded &inst);
+    void br(const decoded &inst);
+    void jmp(const decoded &inst);
+    void jsr(const decoded &inst);
+    void ld(const decoded &inst);
+    void ldi(const decoded &inst);
+    void ldr(const decoded &inst);
+    void lea(const decoded &inst);
+    void st(const decoded &inst);
+    void sti(const decoded &inst);
+    void str(const decoded &inst);
+    void trap(const decoded &inst);
+    void rti(const decoded &inst);
+    void reserved(const decoded &inst);
+    void breakpoint(const decoded &inst);
 
 private:
     void getc();
@@ -58,14 +199,50 @@ private:
     void in();
     void putsp();
     void halt();
+    void block();
+    void mem_copy();
+    void mem_fill();
+    void str_length();
+    bool plain(uint16_t address, uint16_t count) const;
 
-private:
-    void enable_echo(bool enable);
+    typedef void (vm::*trap_routine)();
+    static const std::array<trap_routine, 256> &trap_routines();
 
 private:
     bool running_;
+    bool stop_;
+    exit_reason reason_;
+    bool prompted_ = false;
+    uint16_t entry_ = 0x3000;
+    uint64_t executed_ = 0;
     memory memory_;
+    std::bitset<256> native_traps_;
+    trap_table trap_table_;
+    std::vector<host_trap> host_traps_;     // by vector, empty until one is set
+    std::unique_ptr<input_source> input_;
+    keyboard keyboard_;
+    interrupt_controller interrupts_;
+    uint32_t level_mask_ = 1;   // pending() bits the running priority masks
+    watch_list watches_;
+    watch_hit last_watch_ = { 0, false };
+    int32_t resume_at_ = -1;    // the breakpoint the vm stopped on
+    uint8_t timer_vector_ = 0;
+    int timer_priority_ = 0;
+    uint64_t timer_period_ = 0;
+    extension *extension_ = nullptr;
+    uint64_t extension_poll_ = 0;
+    std::unique_ptr<output_buffer> output_;
+    decode_cache decoded_;
+    bool fusing_ = true;    // false while a watchpoint is set
+    bool jit_enabled_ = false;
+#ifdef LC3_JIT
+    std::unique_ptr<jit> jit_;     // created on first run, see use_jit()
+#endif
+    const aot_image *aot_ = nullptr;
+    profiler *profiler_ = nullptr;
+    trace_recorder *tracer_ = nullptr;
     std::array<uint16_t, registers::count> registers_ = { 0 };
+    uint16_t cc_ = 0;   // the last result, N, Z and P are worked out when read
 
 };
 
@@ -18,8 +18,12 @@
 #define _lc3extension_h_
 
 // Export type.  Methods defined with LC_API must be exported from the LC3 Simulator
-// extension DLL.
+// extension DLL.  Elsewhere the extension is a shared object loaded with dlopen.
+#ifdef _WIN32
 #define LC_API extern "C" __declspec(dllexport)
+#else
+#define LC_API extern "C" __attribute__((visibility("default")))
+#endif
 
 // Each memory location and register is 16 bit
 #define BITS unsigned short
@@ -0,0 +1,271 @@
+/*
+Copyright (c) 2014 MVPETE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef __NPP_CLIENT_H__
+#define __NPP_CLIENT_H__
+#include "shared.h"
+
+#include <string.h>
+#include <sstream>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+////////////////////////////////////////////////////////////////////////////////////
+/// npp_client - a wrapper for Windows named pipe for communication
+class npp_client
+{
+	HANDLE pipe_;
+
+public:
+
+	npp_client(const char *pipe_name)
+	{
+		// open the connection to the named pipe
+		pipe_ = ::CreateFileA(pipe_name,
+			GENERIC_READ | GENERIC_WRITE,
+			0,
+			NULL,
+			OPEN_EXISTING,
+			0,
+			NULL);
+		if( pipe_ == INVALID_HANDLE_VALUE )
+		{
+			std::stringstream ss;
+			ss << "failed to initialized pipe connection - " << ::GetLastError();
+			throw std::runtime_error(ss.str());
+		}
+	}
+	~npp_client()
+	{
+		::CloseHandle(pipe_);
+	}
+
+	
+	int write(const unsigned char *buffer, int size, int timeout)
+	{
+		io_event ioe;
+
+		OVERLAPPED io;
+		memset(&io,0, sizeof(OVERLAPPED));
+
+		io.hEvent = ioe.handle();
+
+		DWORD bwritten(0);
+		/// write to the pipe, wait if nescessary
+		if(!::WriteFile(pipe_,buffer,size,&bwritten,&io))
+		{
+			DWORD res = ::GetLastError();
+			if( res == ERROR_IO_PENDING )
+			{
+				// this will block on the wait until it's triggered
+				if(ioe.wait(timeout) && ::GetOverlappedResult(pipe_,&io,&bwritten,false))
+					return bwritten;
+				else
+				{
+					::CancelIo(pipe_);
+				}
+			}
+			else
+			{
+				std::stringstream ss;
+				ss << "Failed to write to stream - " <<::GetLastError();
+				throw std::runtime_error(ss.str());
+			}
+		}
+		return bwritten;
+	}
+
+	int read(unsigned char *buffer, int size, int timeout)
+	{
+		io_event ioe;
+		OVERLAPPED io;
+		memset(&io,0,sizeof(OVERLAPPED));
+		io.hEvent = ioe.handle();
+
+		DWORD bread(0);
+		// read the pipe, wait timeout if nescesaary
+		if(!::ReadFile(pipe_,buffer,size,&bread,&io))
+		{
+			DWORD res = ::GetLastError();
+			if( res == ERROR_IO_PENDING )
+			{
+				// this will block on the wait until it's triggered
+				if(ioe.wait(timeout) && ::GetOverlappedResult(pipe_,&io,&bread,false))
+					return bread;
+				else
+				{
+					::CancelIo(pipe_);
+				}
+			}
+			else
+			{
+				std::stringstream ss;
+				ss << "Failed to read from stream - " <<::GetLastError();
+				throw std::runtime_error(ss.str());
+			}
+		}
+		return bread;
+	}
+
+};
+#else
+////////////////////////////////////////////////////////////////////////////////////
+/// npp_client - the same client over a Unix domain socket, see npp_server
+class npp_client
+{
+	int pipe_;
+
+	void fail(const char *what)
+	{
+		std::stringstream ss;
+		ss << what << errno;
+		throw std::runtime_error(ss.str());
+	}
+
+public:
+
+	npp_client(const char *pipe_name)
+	{
+		sockaddr_un addr;
+		memset(&addr,0,sizeof(sockaddr_un));
+		addr.sun_family = AF_UNIX;
+		if( strlen(pipe_name) >= sizeof(addr.sun_path) )
+			throw std::runtime_error("failed to initialized pipe connection - name too long");
+		strcpy(addr.sun_path,pipe_name);
+
+		// open the connection to the named pipe
+		pipe_ = ::socket(AF_UNIX,SOCK_STREAM,0);
+		if( pipe_ < 0 )
+			fail("failed to initialized pipe connection - ");
+		if( ::connect(pipe_,(sockaddr*)&addr,sizeof(sockaddr_un)) != 0 )
+		{
+			int res = errno;
+			::close(pipe_);
+			errno = res;
+			fail("failed to initialized pipe connection - ");
+		}
+	}
+	~npp_client()
+	{
+		::close(pipe_);
+	}
+
+	
+	int write(const unsigned char *buffer, int size, int timeout)
+	{
+		int bwritten(0);
+		while( bwritten < size )
+		{
+			pollfd p = { pipe_, POLLOUT, 0 };
+			if( ::poll(&p,1,timeout) <= 0 )
+				break; // timed out
+			ssize_t res = ::send(pipe_,buffer+bwritten,size-bwritten,MSG_NOSIGNAL);
+			if( res < 0 && errno != EINTR )
+				fail("Failed to write to stream - ");
+			if( res > 0 )
+				bwritten += (int)res;
+		}
+		return bwritten;
+	}
+
+	int read(unsigned char *buffer, int size, int timeout)
+	{
+		pollfd p = { pipe_, POLLIN, 0 };
+		if( ::poll(&p,1,timeout) <= 0 )
+			return 0;
+		ssize_t bread = ::recv(pipe_,buffer,size,0);
+		if( bread < 0 && errno != ECONNRESET )
+			fail("Failed to read from stream - ");
+		return bread < 0 ? 0 : (int)bread;
+	}
+
+};
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////
+/// message - a message builder to make it convient to build buffers
+/// warning - no checks on buffer size
+class message
+{
+	unsigned char buf_[255];
+	int  size_;
+	unsigned char &msg_size_;
+	unsigned char &fc_;
+
+	void commit(int bytes);
+
+public:
+
+	message():
+	msg_size_(buf_[3]),
+	fc_(buf_[4])
+	{
+		memset(buf_,0,255);
+		memcpy(buf_,"SSP",3);
+		size_=5;
+	}
+
+
+	void function(unsigned char fc)
+	{
+		fc_=fc;
+	}
+
+	void push_back(const char *s, int cnt)
+	{
+		if(size_ + cnt > 255)
+			throw std::runtime_error("overflow");
+
+		memcpy(&buf_[size_],s,cnt);
+		size_+=cnt;
+	}
+	void push_back(const char *str)
+	{
+		push_back(str,strlen(str)+1);
+	}
+
+	void push_back(int val)
+	{
+		if(size_ +sizeof(int) > 255)
+			throw std::runtime_error("overflow");
+		memcpy(&buf_[size_],&val,sizeof(int));
+		size_+=sizeof(int);
+	}
+
+	void package()
+	{
+		msg_size_=size_;
+	}
+
+	const unsigned char* c_ptr() { return buf_; }
+
+	int size() { return size_; }
+};
+
+#endif // __NPP_CLIENT_H__
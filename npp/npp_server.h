@@ -0,0 +1,304 @@
+/*
+Copyright (c) 2014 MVPETE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef __NPP_SERVER_H__
+#define __NPP_SERVER_H__
+#include "shared.h"
+
+#include <string.h>
+#include <sstream>
+#include <string>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+////////////////////////////////////////////////////////////////////////////////////
+/// npp_server - named pipe server, encapsulates the Windows named pipe creation,
+/// reading and writing.
+/// important - keep in mind the name format
+class npp_server
+{
+	HANDLE pipe_;
+	std::string name_;
+	int clients_allowed_;
+
+	explicit npp_server(HANDLE pipe):pipe_(pipe),clients_allowed_(0){}
+
+	HANDLE create()
+	{
+		HANDLE pipe = ::CreateNamedPipeA(name_.c_str(),
+			PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+			PIPE_TYPE_BYTE | PIPE_WAIT,
+			clients_allowed_,
+			512, // 512 byte buffer out
+			512, // 512 byte buffer in
+			5000, // 5 second timeout
+			NULL);
+
+		if( pipe == INVALID_HANDLE_VALUE )
+		{
+			std::stringstream ss;
+			ss << "failed to create pipe server - " << ::GetLastError();
+			throw std::runtime_error(ss.str());
+		}
+		return pipe;
+	}
+
+public:
+	// name format - "\\\\.\\pipe\\comm_pipe"
+	npp_server(const char *pipe_name, int clients_allowed)
+		:name_(pipe_name),clients_allowed_(clients_allowed)
+	{
+		pipe_ = create();
+	}
+	void disconnect() { ::DisconnectNamedPipe(pipe_); }
+	~npp_server()
+	{
+		
+		::CloseHandle(pipe_);
+	}
+
+	/// hands the connected client to a server of its own, which the caller
+	/// owns, and opens the next instance of the pipe for the next client;
+	/// clients_allowed is how many instances there may be at once
+	npp_server *detach_client()
+	{
+		HANDLE next = create();
+		npp_server *client = new npp_server(pipe_);
+		pipe_ = next;
+		return client;
+	}
+
+	/// waits for a client to connect, or timeout
+	bool wait_for_client(int timeout)
+	{
+		OVERLAPPED io;
+		memset(&io,0,sizeof(OVERLAPPED));
+		io_event ioe;
+		io.hEvent=ioe.handle();
+		if( !::ConnectNamedPipe(pipe_,&io) )
+		{
+			DWORD res = ::GetLastError();
+			if(res == ERROR_PIPE_CONNECTED) // connected before we asked
+				return true;
+			if(res != ERROR_IO_PENDING)
+				return false;
+			DWORD unused(0);
+			if(ioe.wait(timeout))
+				return ::GetOverlappedResult(pipe_,&io,&unused,false) != 0;
+			// io and ioe go away with this frame, the connect must not outlive
+			// them; it may still have completed before the cancel
+			::CancelIo(pipe_);
+			return ::GetOverlappedResult(pipe_,&io,&unused,true) != 0;
+		}
+		return true;
+	}
+
+	int write(const char *buffer, int size, int timeout)
+	{
+		io_event ioe;
+
+		OVERLAPPED io;
+		memset(&io,0, sizeof(OVERLAPPED));
+
+		io.hEvent = ioe.handle();
+
+		DWORD bwritten(0);
+
+		if(!::WriteFile(pipe_,buffer,size,&bwritten,&io))
+		{
+			DWORD res = ::GetLastError();
+			if( res == ERROR_IO_PENDING )
+			{
+				// this will block on the wait until it's triggered
+				if(ioe.wait(timeout) && ::GetOverlappedResult(pipe_,&io,&bwritten,false))
+					return bwritten;
+				else
+				{
+					::CancelIo(pipe_);
+				}
+			}
+			else
+			{
+				std::stringstream ss;
+				ss << "Failed to write to stream - " <<::GetLastError();
+				throw std::runtime_error(ss.str());
+			}
+		}
+		return bwritten;
+	}
+
+	int read(char *buffer, int offset, int size, int timeout)
+	{
+		io_event ioe;
+		OVERLAPPED io;
+		memset(&io,0,sizeof(OVERLAPPED));
+		io.hEvent = ioe.handle();
+
+		DWORD bread(0);
+		if(!::ReadFile(pipe_,buffer+offset,size,&bread,&io))
+		{
+			DWORD res = ::GetLastError();
+			if( res == ERROR_IO_PENDING )
+			{
+				// this will block on the wait until it's triggered
+				if(ioe.wait(timeout) && ::GetOverlappedResult(pipe_,&io,&bread,false))
+					return bread;
+				else
+				{
+					::CancelIo(pipe_);
+				}
+			}
+			else if (res == ERROR_BROKEN_PIPE)
+				return 0; // pipe closed
+			else
+			{
+				std::stringstream ss;
+				ss << "Failed to read from stream - " <<::GetLastError();
+				throw std::runtime_error(ss.str());
+			}
+		}
+		return bread;
+	}
+
+
+};
+#else
+////////////////////////////////////////////////////////////////////////////////////
+/// npp_server - the same server over a Unix domain socket, the pipe name is
+/// the path of the socket
+class npp_server
+{
+	int listen_;
+	int client_;
+	std::string name_;
+
+	explicit npp_server(int client):listen_(-1),client_(client){}
+
+	void fail(const char *what)
+	{
+		std::stringstream ss;
+		ss << what << errno;
+		throw std::runtime_error(ss.str());
+	}
+
+public:
+	// name format - "/tmp/comm_pipe"
+	npp_server(const char *pipe_name, int clients_allowed)
+		:listen_(-1),client_(-1),name_(pipe_name)
+	{
+		sockaddr_un addr;
+		memset(&addr,0,sizeof(sockaddr_un));
+		addr.sun_family = AF_UNIX;
+		if( name_.size() >= sizeof(addr.sun_path) )
+			throw std::runtime_error("failed to create pipe server - name too long");
+		strcpy(addr.sun_path,pipe_name);
+
+		listen_ = ::socket(AF_UNIX,SOCK_STREAM,0);
+		if( listen_ < 0 )
+			fail("failed to create pipe server - ");
+		::unlink(pipe_name); // left behind by a server that did not shut down
+		if( ::bind(listen_,(sockaddr*)&addr,sizeof(sockaddr_un)) != 0 || ::listen(listen_,clients_allowed) != 0 )
+		{
+			int res = errno;
+			::close(listen_);
+			errno = res;
+			fail("failed to create pipe server - ");
+		}
+	}
+	void disconnect()
+	{
+		if( client_ >= 0 )
+			::close(client_);
+		client_ = -1;
+	}
+	~npp_server()
+	{
+		disconnect();
+		if( listen_ >= 0 )
+		{
+			::close(listen_);
+			::unlink(name_.c_str());
+		}
+	}
+
+	/// hands the connected client to a server of its own, which the caller
+	/// owns, and goes back to listening for the next client; clients_allowed
+	/// is the backlog of the listening socket
+	npp_server *detach_client()
+	{
+		npp_server *client = new npp_server(client_);
+		client_ = -1;
+		return client;
+	}
+
+	/// waits for a client to connect, or timeout
+	bool wait_for_client(int timeout)
+	{
+		pollfd p = { listen_, POLLIN, 0 };
+		if( ::poll(&p,1,timeout) <= 0 )
+			return false;
+		client_ = ::accept(listen_,NULL,NULL);
+		return client_ >= 0;
+	}
+
+	int write(const char *buffer, int size, int timeout)
+	{
+		int bwritten(0);
+		while( bwritten < size )
+		{
+			pollfd p = { client_, POLLOUT, 0 };
+			if( ::poll(&p,1,timeout) <= 0 )
+				break; // timed out
+			ssize_t res = ::send(client_,buffer+bwritten,size-bwritten,MSG_NOSIGNAL);
+			if( res < 0 && errno != EINTR )
+				fail("Failed to write to stream - ");
+			if( res > 0 )
+				bwritten += (int)res;
+		}
+		return bwritten;
+	}
+
+	int read(char *buffer, int offset, int size, int timeout)
+	{
+		pollfd p = { client_, POLLIN, 0 };
+		if( ::poll(&p,1,timeout) <= 0 )
+			return 0;
+		ssize_t bread = ::recv(client_,buffer+offset,size,0);
+		if( bread < 0 )
+		{
+			if( errno == ECONNRESET )
+				return 0; // pipe closed
+			fail("Failed to read from stream - ");
+		}
+		return (int)bread;
+	}
+};
+#endif
+
+#endif // __NPP_SERVER_H__
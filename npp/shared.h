@@ -22,7 +22,18 @@ THE SOFTWARE.
 
 #ifndef __NPP_SHARED_H__
 #define __NPP_SHARED_H__
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#define INFINITE -1
+#endif
 
 #include <stdexcept>
 
@@ -33,9 +44,14 @@ THE SOFTWARE.
 #define FN_READ_X  0x03
 #define FN_READ_S  0x04
 
+/// frame - "SSP", total size of the frame including this header, function code
+#define SSP_HEADER      5
+#define SSP_MAX_PAYLOAD (255-SSP_HEADER)
+
 
 ////////////////////////////////////////////////////////////////////////////////////
 /// io_event - wraps Windows event, allows a timeoutable wait
+#ifdef _WIN32
 class io_event
 {
 	HANDLE event_;
@@ -65,5 +81,43 @@ public:
 
 	HANDLE handle() { return event_; }
 };
+#else
+/// same thing on a condition variable, there is no handle to wait on
+class io_event
+{
+	std::mutex lock_;
+	std::condition_variable cv_;
+	bool auto_reset_;
+	bool set_;
+
+public:
+	io_event(bool auto_reset=false):auto_reset_(auto_reset),set_(false){}
+
+	bool wait(int timeout)
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		auto is_set = [this]{ return set_; };
+		if( timeout < 0 )
+			cv_.wait(lock,is_set);
+		else if( !cv_.wait_for(lock,std::chrono::milliseconds(timeout),is_set) )
+			return false;
+		if( auto_reset_ )
+			set_ = false;
+		return true;
+	}
+
+	void set()
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		set_ = true;
+		cv_.notify_all();
+	}
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		set_ = false;
+	}
+};
+#endif
 
 #endif // __NPP_SHARED_H__
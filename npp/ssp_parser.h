@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2014 MVPETE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef __NPP_SSP_PARSER_H__
+#define __NPP_SSP_PARSER_H__
+#include "npp_server.h"
+
+#include <string.h>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////
+/* 
+	ssp_parser - parser class for the SSP protocol, handles the two functions
+	to write a string and write an integer value, anything else goes to
+	on_function() which may answer through send().
+
+	usage - supply named pipe server and callbacks implementation, named pipe
+	server must already be setup and connected to client.
+
+*/
+class ssp_parser
+{
+	
+	npp_server &srv_;
+	char rbuf_[512];
+	int size_;
+	std::string wbuf_; // responses, written once the frames read so far are handled
+
+	bool process_buffer()
+	{
+		while(size_ >= SSP_HEADER)
+		{
+			unsigned char msg_size = rbuf_[3];
+			if( memcmp(rbuf_,"SSP",3) != 0 || msg_size < SSP_HEADER )
+				return false; // lost the framing, nothing to resync on
+			if( size_ < msg_size )
+				return true;
+		
+			unsigned char fc = rbuf_[4];
+			switch(fc)
+			{
+			case FN_WRITE_X:
+				cb_.on_write_x(*(int*)(rbuf_+5));
+				break;
+			case FN_WRITE_S:
+				{
+					char *buf = new char[msg_size-5];
+					memcpy(buf,rbuf_+5,msg_size-5);
+					cb_.on_write_s(buf);
+					delete []buf;
+				}
+				break;
+			default:
+				cb_.on_function(this,fc,rbuf_+5,msg_size-5);
+				break;
+			}
+
+			// pop off the msg 
+			const char *offset_ptr=rbuf_+msg_size;
+			int cpyout = size_-msg_size;
+			memmove(rbuf_,offset_ptr, cpyout);
+			size_-= msg_size;
+		}
+		return true;
+	}
+
+public:
+	class callbacks
+	{
+	public:
+		virtual ~callbacks(){};
+		virtual void on_write_x(int value) {}
+		virtual void on_write_s(const char *str) {}
+		/// any other function code, payload is size bytes
+		virtual void on_function(ssp_parser *rsp, unsigned char fc, const char *payload, int size) {}
+
+	};
+
+
+	ssp_parser(npp_server &srv, callbacks &cb):srv_(srv),size_(0),cb_(cb){}
+
+	/// queues a frame, payload is at most SSP_MAX_PAYLOAD bytes
+	void send(unsigned char fc, const char *payload, int size)
+	{
+		if( size < 0 || size > SSP_MAX_PAYLOAD )
+			throw std::runtime_error("overflow");
+		char header[SSP_HEADER] = { 'S', 'S', 'P', (char)(size+SSP_HEADER), (char)fc };
+		wbuf_.append(header,SSP_HEADER);
+		wbuf_.append(payload,size);
+		if( wbuf_.size() >= 4096 ) // long answers go out as they are made
+			flush();
+	}
+
+	void send_read_x_rsp(int value)
+	{
+		send(FN_READ_X,(const char*)&value,sizeof(int));
+	}
+	void send_read_s_rsp(const char *value)
+	{
+		send(FN_READ_S,value,(int)strlen(value)+1);
+	}
+
+	void flush()
+	{
+		if( !wbuf_.empty() )
+			srv_.write(wbuf_.data(),(int)wbuf_.size(),INFINITE);
+		wbuf_.clear();
+	}
+
+
+	void run(io_event &ioe)
+	{
+		size_ = 0;
+		wbuf_.clear();
+		while(!ioe.wait(0)) // running
+		{
+			int read = srv_.read(rbuf_,size_, 512-size_,INFINITE);
+			if (read == 0)
+				return;
+			size_ += read;
+			if( size_ < SSP_HEADER ) // read header and length
+				continue;
+
+			bool framed = process_buffer();
+			flush();
+			if( !framed )
+				return;
+		}
+	}
+
+private:
+	callbacks &cb_;
+
+};
+
+#endif // __NPP_SSP_PARSER_H__